@@ -1,33 +1,301 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <chrono>
 #include <thread>
 #include <future>
-
-#if defined(__linux__)
+#include <condition_variable>
+#include <array>
 #include <memory>
 #include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <unordered_map>
+#include <deque>
 #include <fstream>
 #include <sstream>
 #include <iterator>
-#include <algorithm>
 
 #include <sys/types.h>
 #include <sys/sysinfo.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
+#include <fnmatch.h>
+#include <cstdio>
+#include <climits>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <linux/input.h>
 #elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
 #endif
 
 class InputDeviceListener final
 {
 public:
-	InputDeviceListener() {}
-    ~InputDeviceListener() { stop(); }
+    enum class DeviceClass : uint8_t
+    {
+        Keyboard,
+        Pointer,
+        Touch,
+        Sensor,
+        Other,
+        Count
+    };
+
+#if defined(__linux__)
+    enum class DiscoverySource : uint8_t
+    {
+        ProcFs,     // parse /proc/bus/input/devices on every rescan
+        SysFs       // enumerate /sys/class/input, reading attributes only for nodes not seen before
+    };
+
+    using Bitmap = std::vector<unsigned long>;
+
+    static bool testBit(const Bitmap &bits, int bit)
+    {
+        const size_t wordBits = sizeof(unsigned long) * 8;
+        const size_t word = static_cast<size_t>(bit) / wordBits;
+
+        if (word >= bits.size())
+        {
+            return false;
+        }
+
+        return (bits[word] >> (static_cast<size_t>(bit) % wordBits)) & 1UL;
+    }
+
+    // bus:16 | vendor:16 | product:16 | version:16, so matching and grouping are integer compares.
+    static constexpr uint64_t makeDeviceKey(uint16_t bus, uint16_t vendor, uint16_t product, uint16_t version = 0)
+    {
+        return (static_cast<uint64_t>(bus) << 48) | (static_cast<uint64_t>(vendor) << 32)
+             | (static_cast<uint64_t>(product) << 16) | static_cast<uint64_t>(version);
+    }
+
+    // Everything /proc/bus/input/devices reports about one evdev node.
+    struct DeviceInfo
+    {
+        uint64_t    key{ 0 };
+        std::string name;
+        std::string phys;
+        std::string sysfs;
+        std::string uniq;
+        std::string handler;        // /dev/input/eventN
+        uint64_t    group{ 0 };     // hash of the physical device the node belongs to
+        DeviceClass deviceClass{ DeviceClass::Other };
+
+        Bitmap      prop;
+        Bitmap      ev;
+        Bitmap      keys;
+        Bitmap      rel;
+        Bitmap      abs;
+        Bitmap      msc;
+        Bitmap      sw;
+        Bitmap      led;
+        Bitmap      snd;
+        Bitmap      ff;
+
+        uint16_t bus() const { return static_cast<uint16_t>(key >> 48); }
+        uint16_t vendor() const { return static_cast<uint16_t>(key >> 32); }
+        uint16_t product() const { return static_cast<uint16_t>(key >> 16); }
+        uint16_t version() const { return static_cast<uint16_t>(key); }
+    };
+
+    // Nodes sharing one physical device (e.g. a keyboard's main and media key interfaces).
+    struct DeviceGroup
+    {
+        uint64_t                 id{ 0 };
+        std::string              name;      // name of the first node
+        std::vector<std::string> handlers;
+        uint64_t                 events{ 0 };
+        time_t                   lastOperateTime{ 0 };
+    };
+
+    // Decides whether a device is opened at all. Rules are evaluated in order and the first match wins;
+    // devices matching no rule are allowed. Empty strings, -1 ids and a zero class mask match anything.
+    struct DeviceRule
+    {
+        enum class Action : uint8_t
+        {
+            Allow,
+            Deny,
+            Lazy        // allowed, but only opened while a started subscriber asks for its class
+        };
+
+        Action      action{ Action::Deny };
+        int         priority{ 0 };  // under an fd budget higher priorities are opened first
+        std::string name;           // glob on the device name, e.g. "*Power Button*"
+        std::string phys;           // glob on the phys path, e.g. "usb-*"
+        int         bus{ -1 };      // BUS_USB, BUS_VIRTUAL, ...
+        int         vendor{ -1 };
+        int         product{ -1 };
+        uint32_t    classes{ 0 };   // mask of (1u << DeviceClass)
+    };
+#endif
+
+    struct StartupMetrics
+    {
+        std::chrono::microseconds discovery{ 0 };         // reading /proc or enumerating sysfs
+        std::chrono::microseconds parse{ 0 };             // parsing /proc/bus/input/devices
+        std::chrono::microseconds open{ 0 };              // opening and probing the initial devices
+        std::chrono::microseconds ready{ 0 };             // start() until the initial device set was open
+        std::chrono::microseconds firstEvent{ 0 };        // start() until the first input event, 0 if none yet
+        size_t                    devices{ 0 };
+    };
+
+#if defined(__linux__)
+    struct DiscoveryStats
+    {
+        uint64_t fullRescans{ 0 };
+        uint64_t skippedRescans{ 0 };   // device list unchanged since the previous rescan
+    };
+
+    struct HotplugStats
+    {
+        uint64_t                  storms{ 0 };          // coalesced batches, each reconciled once
+        uint64_t                  notifications{ 0 };   // node notifications across all batches
+        uint64_t                  lastStormSize{ 0 };
+        uint64_t                  largestStorm{ 0 };
+        std::chrono::microseconds lastReconcileTime{ 0 };
+        std::chrono::microseconds maxReconcileTime{ 0 };
+    };
+
+    // One evdev event as read from the device, delivered on the reader thread.
+    struct InputEvent
+    {
+        uint32_t    node{ 0 };              // N of /dev/input/eventN
+        uint64_t    device{ 0 };            // DeviceInfo::key
+        DeviceClass deviceClass{ DeviceClass::Other };
+        uint16_t    type{ 0 };
+        uint16_t    code{ 0 };
+        int32_t     value{ 0 };
+        int64_t     time{ 0 };              // kernel timestamp in microseconds
+    };
+
+    using EventHandler = std::function<void(const InputEvent &)>;
+
+    // Reader-side suppression, enabled with a mask of (1u << EventFilter).
+    enum class EventFilter : uint8_t
+    {
+        Autorepeat,         // EV_KEY value 2
+        UnchangedValues,    // key and non-multitouch ABS values equal to the tracked state
+        Count
+    };
+
+    enum class FloodReason : uint8_t
+    {
+        Rate,               // more events per second than FloodPolicy::maxEventsPerSecond
+        IdenticalFrames     // FloodPolicy::maxIdenticalFrames frames in a row with the same content
+    };
+
+    // A flooding device is taken out of the wait set for `quarantine`, doubled for every repeat offence
+    // within a minute of its release, up to five minutes. Zero limits turn a check off; both are off by
+    // default. Frames carrying only relative motion or timestamps never count as identical, since a mouse
+    // moving steadily or a resting touchpad sends those legitimately. Events read in the same batch after
+    // the tripping frame are discarded and subscribers get a SYN_DROPPED, as after a kernel buffer overrun.
+    struct FloodPolicy
+    {
+        uint32_t                  maxEventsPerSecond{ 0 };
+        uint32_t                  maxIdenticalFrames{ 0 };
+        std::chrono::milliseconds quarantine{ 10000 };
+    };
+
+    struct QuarantineEvent
+    {
+        DeviceInfo                device;
+        bool                      quarantined{ true };  // false when the device is released
+        FloodReason               reason{ FloodReason::Rate };
+        std::chrono::milliseconds duration{ 0 };
+    };
+
+    using QuarantineHandler = std::function<void(const QuarantineEvent &)>;
+
+    struct FloodStats
+    {
+        uint64_t quarantines{ 0 };
+        uint64_t releases{ 0 };
+        uint64_t quarantined{ 0 };      // devices out of the wait set right now
+    };
+
+    struct SuspendStats
+    {
+        uint64_t                  resumes{ 0 };
+        uint64_t                  reopened{ 0 };    // nodes that were gone after a resume
+        std::chrono::milliseconds lastSuspend{ 0 };
+    };
+
+    struct FilterStats
+    {
+        uint64_t autorepeat{ 0 };
+        uint64_t unchanged{ 0 };
+        uint64_t emptyFrames{ 0 };      // SYN_REPORTs whose whole frame was suppressed
+    };
+
+    struct IdleEvent
+    {
+        int                       id{ 0 };          // from addIdleTimer()
+        bool                      idle{ true };     // false on the first input after going idle
+        std::chrono::milliseconds idleFor{ 0 };     // since the last input the timer counts
+    };
+
+    using IdleHandler = std::function<void(const IdleEvent &)>;
+
+    // One contiguous run of the broadcast ring, valid only during the call.
+    using StreamBatch = std::function<void(const InputEvent *events, size_t count)>;
+
+    struct StreamStats
+    {
+        uint64_t published{ 0 };
+        uint64_t dropped{ 0 };          // found the slowest consumer a full ring behind
+        size_t   consumers{ 0 };
+    };
+#endif
+
+    enum class Mode : uint8_t
+    {
+        Exclusive,  // this listener owns its reader thread and device fds
+        Shared      // attach to the process-wide reader; settings are shared by every shared listener
+    };
+
+    explicit InputDeviceListener(Mode mode = Mode::Exclusive)
+        : m_core{ (mode == Mode::Shared) ? Core::shared() : std::make_shared<Core>() } {}
+    ~InputDeviceListener()
+    {
+        stop();
+#if defined(__linux__)
+        for (auto id : m_subscriptions)
+        {
+            m_core->unsubscribe(id);
+        }
+        for (auto id : m_idleTimers)
+        {
+            m_core->removeIdleTimer(id);
+        }
+        for (auto id : m_streams)
+        {
+            m_core->closeStream(id, this);
+        }
+#endif
+    }
 
 	InputDeviceListener(const InputDeviceListener &) = delete;
 	InputDeviceListener(InputDeviceListener &&) = delete;
@@ -37,26 +305,362 @@ public:
 
     bool isRunning() const { return m_isRunning; }
 
-    time_t lastOperateTime() const { return m_lastOperateTime; }
+    time_t lastOperateTime() const { return m_core->lastOperateTime(); }
+
+    // Last activity of a single device class. Only tracked on Linux, where devices are read directly.
+    time_t lastOperateTime(DeviceClass cls) const { return m_core->lastOperateTime(cls); }
+
+    // Monotonically increasing counter, bumped every time input activity is stamped.
+    uint64_t activitySequence() const { return m_core->activitySequence(); }
+
+    // Blocks until the activity sequence moves past `since`, the timeout expires or this listener stops.
+    // Returns true if new activity was observed. Idle waiters sleep in the kernel (futex / WaitOnAddress).
+    bool waitForActivity(uint64_t since, std::chrono::milliseconds timeout = (std::chrono::milliseconds::max)())
+    {
+        return m_core->waitForActivity(since, timeout, m_isRunning);
+    }
+
+    // Sensors (accelerometers and other continuous ABS sources) are not user activity and are left closed
+    // by default. When enabled they are opened and only update lastOperateTime(DeviceClass::Sensor). A started
+    // subscriber that asks for DeviceClass::Sensor opens them as well, for as long as it stays started.
+    void setSensorsEnabled(bool enabled) { m_core->setSensorsEnabled(enabled); }
+    bool sensorsEnabled() const { return m_core->sensorsEnabled(); }
+
+#if defined(__linux__)
+    // Snapshot of the devices currently opened by the listener, refreshed on every rescan.
+    std::vector<DeviceInfo> devices() const { return m_core->devices(); }
+
+    std::vector<DeviceGroup> deviceGroups() const { return m_core->deviceGroups(); }
+
+    // Activity-only mode: open just the primary node(s) of each physical device, i.e. one node per
+    // keyboard/pointer/touch class, dropping auxiliary nodes such as consumer or system control.
+    void setPrimaryNodesOnly(bool enabled) { m_core->setPrimaryNodesOnly(enabled); }
+    bool primaryNodesOnly() const { return m_core->primaryNodesOnly(); }
+
+    void setDiscoverySource(DiscoverySource source) { m_core->setDiscoverySource(source); }
+    DiscoverySource discoverySource() const { return m_core->discoverySource(); }
+
+    // Persists the probed device table to `path` (empty disables it). On the next start the table is
+    // validated with stat() on every node and, if nothing was replugged, used instead of parsing and
+    // probing again. Takes effect on the next start().
+    void setDeviceCachePath(const std::string &path) { m_core->setDeviceCachePath(path); }
+
+    // New nodes are opened on a small worker pool; a node still blocked in open() after this long is
+    // left to finish in the background and picked up by a later rescan.
+    void setProbeTimeout(std::chrono::milliseconds timeout) { m_core->setProbeTimeout(timeout); }
+    std::chrono::milliseconds probeTimeout() const { return m_core->probeTimeout(); }
+
+    // Hotplug notifications arriving within this window of each other are reconciled in one pass.
+    void setHotplugWindow(std::chrono::milliseconds window) { m_core->setHotplugWindow(window); }
+    std::chrono::milliseconds hotplugWindow() const { return m_core->hotplugWindow(); }
+
+    HotplugStats hotplugStats() const { return m_core->hotplugStats(); }
+
+    // Resumes are detected from CLOCK_BOOTTIME running ahead of CLOCK_MONOTONIC.
+    SuspendStats suspendStats() const { return m_core->suspendStats(); }
+    DiscoveryStats discoveryStats() const { return m_core->discoveryStats(); }
+
+    // Rules are compiled here once; the reader only evaluates them for devices it has not seen yet.
+    void setDeviceRules(const std::vector<DeviceRule> &rules) { m_core->setDeviceRules(rules); }
+
+    // Upper bound on open device nodes; 0 (the default) uses a quarter of RLIMIT_NOFILE. Devices are given
+    // slots by rule priority, then keyboards, pointers, touch, other and sensors; the rest are reported by
+    // skippedDevices() and opened once slots free up.
+    void setFdBudget(size_t devices) { m_core->setFdBudget(devices); }
+    size_t fdBudget() const { return m_core->fdBudget(); }
+
+    std::vector<DeviceInfo> skippedDevices() const { return m_core->skippedDevices(); }
+
+    // Hands an already opened evdev fd to the listener, e.g. one passed by logind's TakeDevice or a
+    // privileged helper. The listener owns it from here on and reads it like a discovered device until
+    // reads fail or the listener stops. `info` describes it; handler, rules and the fd budget are ignored.
+    bool attachDevice(int fd, DeviceInfo info) { return m_core->attachDevice(fd, std::move(info)); }
+
+    // Dropped events neither stamp activity nor reach subscribers. Key and ABS state per device is seeded with
+    // EVIOCGKEY/EVIOCGABS when the node is opened and re-read after SYN_DROPPED.
+    void setEventFilters(uint32_t filters) { m_core->setEventFilters(filters); }
+    uint32_t eventFilters() const { return m_core->eventFilters(); }
+
+    FilterStats filterStats() const { return m_core->filterStats(); }
+
+    // Autorepeat frames and MSC_TIMESTAMP do not count towards identical frames.
+    void setFloodPolicy(const FloodPolicy &policy) { m_core->setFloodPolicy(policy); }
+    FloodPolicy floodPolicy() const { return m_core->floodPolicy(); }
+
+    // Called on the reader thread when a device is quarantined or released. Shared listeners share one handler,
+    // which is bound by the same rules as subscription handlers.
+    void setQuarantineHandler(QuarantineHandler handler) { m_core->setQuarantineHandler(std::move(handler)); }
+
+    FloodStats floodStats() const { return m_core->floodStats(); }
+
+    // Edge-triggered waiting: devices are only looked at again when new data arrives, or, if a visit
+    // stopped at its quota, from a list of devices that still have data. Takes effect on the next start().
+    void setEdgeTriggered(bool enabled) { m_core->setEdgeTriggered(enabled); }
+    bool edgeTriggered() const { return m_core->edgeTriggered(); }
+
+    // Handlers run on the reader thread, only while this listener is started and not paused. They may pause,
+    // resume or reconfigure the listener but must not call subscribe()/unsubscribe() or stop it. `classes` is a mask of (1u << DeviceClass) and `types` one of
+    // (1u << EV_*), 0 for all; `codes` narrows the chosen types to those codes, empty for all. Devices
+    // matched by a Lazy rule, and sensors, are only opened while a started subscriber asks for their class.
+    // Returns an id for unsubscribe().
+    int subscribe(EventHandler handler, uint32_t classes = 0, uint32_t types = 0, std::vector<uint16_t> codes = {})
+    {
+        // dispatch holds the core's lock while a handler may be waiting for m_mtx, so it is not held here
+        const int id = m_core->subscribe(std::move(handler), classes, types, std::move(codes), &m_isListening);
+        std::unique_lock<std::mutex> lock{ m_mtx };
+        m_subscriptions.push_back(id);
+        return id;
+    }
+
+    // Once this returns the handler is not running and will not be called again.
+    void unsubscribe(int id)
+    {
+        std::unique_lock<std::mutex> lock{ m_mtx };
+        auto it = std::find(m_subscriptions.begin(), m_subscriptions.end(), id);
+        if (it != m_subscriptions.end())
+        {
+            m_subscriptions.erase(it);
+            lock.unlock();
+            m_core->unsubscribe(id);
+        }
+    }
+
+    // Calls handler with idle=true once none of `classes` (a DeviceClass mask, 0 for every class but sensors)
+    // has produced input for `threshold`, and with idle=false on the next such input. Any number of timers
+    // share one timing wheel and one timerfd, so input costs the same however many are armed. Handlers run on
+    // the reader thread while this listener is started and not paused; they may pause, resume or reconfigure
+    // the listener but must not add or remove idle timers or stop it.
+    // Returns an id for removeIdleTimer().
+    int addIdleTimer(std::chrono::milliseconds threshold, IdleHandler handler, uint32_t classes = 0)
+    {
+        // the core's idle lock is taken without m_mtx, which a running handler may be waiting for
+        const int id = m_core->addIdleTimer(threshold, std::move(handler), classes, &m_isListening);
+        if (id != 0)
+        {
+            std::unique_lock<std::mutex> lock{ m_mtx };
+            m_idleTimers.push_back(id);
+        }
+        return id;
+    }
+
+    // Once this returns the handler is not running and will not be called again.
+    void removeIdleTimer(int id)
+    {
+        {
+            std::unique_lock<std::mutex> lock{ m_mtx };
+            auto it = std::find(m_idleTimers.begin(), m_idleTimers.end(), id);
+            if (it == m_idleTimers.end())
+            {
+                return;
+            }
+            m_idleTimers.erase(it);
+        }
+        m_core->removeIdleTimer(id);
+    }
+
+    // Every event subscribers could see is also written once into a broadcast ring, shared by any number of
+    // consumers that each read it at their own pace. The reader never waits for them: while the slowest open
+    // consumer is a full ring behind, new events are dropped for everyone, so close streams no longer read.
+    // The capacity (rounded up to a power of two) is fixed when the first stream is opened.
+    void setStreamCapacity(size_t events) { m_core->setStreamCapacity(events); }
+
+    // Returns a stream id that sees events published from now on, or 0 when no cursor is free.
+    int openStream()
+    {
+        std::unique_lock<std::mutex> lock{ m_mtx };
+        const int id = m_core->openStream(this);
+        if (id != 0)
+        {
+            m_streams.push_back(id);
+        }
+        return id;
+    }
+
+    void closeStream(int id)
+    {
+        std::unique_lock<std::mutex> lock{ m_mtx };
+        auto it = std::find(m_streams.begin(), m_streams.end(), id);
+        if (it != m_streams.end())
+        {
+            m_streams.erase(it);
+            m_core->closeStream(id, this);
+        }
+    }
+
+    // Passes up to `max` unread events to `batch` in place, as one or two contiguous runs, and returns how
+    // many were consumed. A stream must be read from one thread at a time. An EV_SYN/SYN_DROPPED in the
+    // stream marks events dropped while the ring was full; ids opened by another listener read nothing.
+    size_t readStream(int id, const StreamBatch &batch, size_t max = SIZE_MAX)
+    {
+        return m_core->readStream(id, this, batch, max);
+    }
+
+    // Returns true once the stream has unread events, false on timeout, when this listener stops or when
+    // it did not open `id`.
+    bool waitStream(int id, std::chrono::milliseconds timeout = (std::chrono::milliseconds::max)())
+    {
+        return m_core->waitStream(id, this, timeout, m_isRunning);
+    }
+
+    StreamStats streamStats() const { return m_core->streamStats(); }
+#endif
 
     bool start() 
 	{
 		std::unique_lock<std::mutex> lock{ m_mtx };
-		return listen(); 
+		if (!m_isRunning)
+		{
+			m_isRunning = m_core->attach();
+			m_isListening = m_isRunning.load();
+#if defined(__linux__)
+			m_core->refreshDemand();
+			m_core->recheckIdleTimers();
+#endif
+		}
+		return m_isRunning;
 	}
+
+    // Stops reading devices while keeping the thread, the open fds and everything probed about them, so
+    // resume() is only a flag and a wakeup. Input arriving while paused is discarded, not reported late.
+    // A shared backend pauses once every started listener on it is paused.
+    void pause()
+    {
+        std::unique_lock<std::mutex> lock{ m_mtx };
+        if (m_isRunning && !m_isPaused)
+        {
+            m_isPaused = true;
+            m_isListening = false;
+#if defined(__linux__)
+            m_core->refreshDemand();
+#endif
+            m_core->pauseView();
+        }
+    }
+
+    void resume()
+    {
+        std::unique_lock<std::mutex> lock{ m_mtx };
+        if (m_isRunning && m_isPaused)
+        {
+            m_isPaused = false;
+            m_isListening = true;
+#if defined(__linux__)
+            m_core->refreshDemand();
+            m_core->recheckIdleTimers();
+#endif
+            m_core->resumeView();
+        }
+    }
+
+    bool isPaused() const { return m_isPaused; }
+
+    // Starts and waits until the initial device set is open. Returns false if that took longer than `timeout`;
+    // the listener keeps running either way.
+    bool start(std::chrono::milliseconds timeout)
+    {
+        if (!start())
+        {
+            return false;
+        }
+
+        return waitUntilReady(timeout);
+    }
+
+    bool isReady() const { return m_isRunning && m_core->isReady(); }
+
+    bool waitUntilReady(std::chrono::milliseconds timeout) const { return m_isRunning && m_core->waitUntilReady(timeout); }
+
+    StartupMetrics startupMetrics() const { return m_core->startupMetrics(); }
+
     void stop() 
 	{
 		std::unique_lock<std::mutex> lock{ m_mtx };
-		shutdown();
+		if (m_isRunning)
+		{
+			if (m_isPaused)
+			{
+				m_isPaused = false;
+				m_core->resumeView();
+			}
+			m_isRunning = false;
+			m_isListening = false;
+#if defined(__linux__)
+			m_core->refreshDemand();
+#endif
+			m_core->releaseWaiters();
+
+			// detaching the last view joins the reader, whose handlers may be waiting for m_mtx
+			lock.unlock();
+			m_core->detach();
+		}
 	}
 
 private:
 #if defined(__linux__)
+    // Key and absolute axis state of one node as last seen by the reader, seeded from the kernel on open.
+    struct DeviceState
+    {
+        static constexpr size_t wordBits = sizeof(unsigned long) * 8;
+        static_assert(ABS_CNT <= 64, "absKnown holds one bit per axis");
+
+        std::array<unsigned long, (KEY_CNT + wordBits - 1) / wordBits> keys{};
+        std::array<int32_t, ABS_CNT>                                  abs{};
+        uint64_t                                                      absKnown{ 0 };
+        bool                                                          dropping{ false };    // SYN_DROPPED until the next SYN_REPORT
+        bool                                                          frameEmpty{ true };   // nothing of the current frame was kept
+
+        void sync(int fd)
+        {
+            keys.fill(0);
+            ::ioctl(fd, EVIOCGKEY(sizeof(keys)), keys.data());
+
+            absKnown = 0;
+            unsigned long axes[(ABS_CNT + wordBits - 1) / wordBits]{};
+            if (::ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(axes)), axes) < 0)
+            {
+                return;
+            }
+
+            for (int code = 0; code < ABS_CNT; ++code)
+            {
+                struct input_absinfo info;
+                if (((axes[code / wordBits] >> (code % wordBits)) & 1UL) && ::ioctl(fd, EVIOCGABS(code), &info) >= 0)
+                {
+                    abs[static_cast<size_t>(code)] = info.value;
+                    absKnown |= 1ull << code;
+                }
+            }
+        }
+    };
+
+    // Per node rate and frame bookkeeping for flood detection.
+    struct FloodState
+    {
+        std::chrono::steady_clock::time_point windowStart;
+        uint32_t                              windowEvents{ 0 };
+        uint64_t                              frameHash{ 14695981039346656037ull };
+        uint64_t                              lastFrameHash{ 0 };
+        bool                                  frameRepeats{ false };    // autorepeat frames are identical by design
+        bool                                  frameCounts{ false };     // has more than REL and timestamps
+        uint32_t                              identicalFrames{ 0 };
+        FloodReason                           reason{ FloodReason::Rate };
+        uint32_t                              strikes{ 0 };
+        std::chrono::steady_clock::time_point quarantinedUntil;         // default when not quarantined
+        std::chrono::steady_clock::time_point releasedAt;
+    };
+
+    // Counters shared by all nodes of a physical device, kept across rescans.
+    struct GroupState
+    {
+        std::atomic<uint64_t> events{ 0 };
+        std::atomic<time_t>   lastOperateTime{ 0 };
+    };
+
     class InputDevice
     {
     public:
-        InputDevice(const std::string &id, const std::string &name, const std::string &handler)
-            : m_fd{ -1 }, m_id{ id }, m_name{ name }, m_handler{ handler } {}
+        explicit InputDevice(DeviceInfo info)
+            : m_fd{ -1 }, m_info{ std::move(info) }, m_node{ nodeNumber(m_info.handler) } {}
         ~InputDevice() { close(); }
 
         InputDevice(const InputDevice &) = delete;
@@ -69,47 +673,53 @@ private:
 
         InputDevice &operator=(InputDevice &&other)
         {
-            m_fd = other.m_fd;
-            m_id = std::move(other.m_id);
-            m_name = std::move(other.m_name);
-            m_handler = std::move(other.m_handler);
+            if (this != &other)
+            {
+                close();
 
-            other.m_fd = -1;
+                m_fd = other.m_fd;
+                m_info = std::move(other.m_info);
+                m_state = std::move(other.m_state);
+                m_node = other.m_node;
+                m_external = other.m_external;
+                m_watched = other.m_watched;
+                m_backlogged = other.m_backlogged;
+                m_flood = other.m_flood;
+                m_ruleGeneration = other.m_ruleGeneration;
+                m_group = std::move(other.m_group);
+
+                other.m_fd = -1;
+            }
 
             return *this;
         }
 
         bool isOpened() const
         {
-            if (::access(m_handler.c_str(), F_OK) == 0)
+            if (::access(m_info.handler.c_str(), F_OK) == 0)
             {
-                return (m_fd == -1);
+                return (m_fd != -1);
             }
 
             return false;
         }
 
-        bool open()
+        // Takes over a node opened and probed by a ProbeJob, refining the class guessed from the
+        // discovery data with the properties reported by the driver itself.
+        void adopt(int fd, const Bitmap &prop, std::unique_ptr<DeviceState> state = nullptr)
         {
-            if (m_fd != -1)
-            {
-                return true;
-            }
-
-            if (m_handler.empty())
-            {
-                return false;
-            }
+            close();
+            m_fd = fd;
+            m_state = std::move(state);
 
-            int fd = ::open(m_handler.c_str(), O_RDONLY);
-            if (fd < 0)
+            if (!prop.empty())
             {
-                ::perror(m_handler.c_str());
-                return false;
+                m_info.prop = prop;
+                if (testBit(m_info.prop, INPUT_PROP_ACCELEROMETER))
+                {
+                    m_info.deviceClass = DeviceClass::Sensor;
+                }
             }
-
-            m_fd = fd;
-            return true;
         }
 
         void close()
@@ -119,20 +729,49 @@ private:
                 ::close(m_fd);
                 m_fd = -1;
             }
+            m_watched = false;
+            m_backlogged = false;
         }
 
         int fd() const { return m_fd; }
-        std::string id() const { return m_name; }
-        std::string name() const { return m_id; }
+        const DeviceInfo &info() const { return m_info; }
+        uint64_t key() const { return m_info.key; }
+        const std::string &name() const { return m_info.name; }
+        const std::string &phys() const { return m_info.phys; }
+        DeviceClass deviceClass() const { return m_info.deviceClass; }
+        uint32_t node() const { return m_node; }
+        DeviceState *state() const { return m_state.get(); }
+
+        // Handed over through attachDevice() rather than found by discovery; kept until it fails or stops.
+        bool external() const { return m_external; }
+        void setExternal(bool external) { m_external = external; }
+
+        // Registered with the reader's epoll set. Closing the fd drops the registration with it.
+        bool watched() const { return m_watched; }
+        void setWatched(bool watched) { m_watched = watched; }
+
+        FloodState &flood() { return m_flood; }
+        bool quarantined() const { return m_flood.quarantinedUntil != std::chrono::steady_clock::time_point{}; }
+
+        // Edge-triggered mode: hit its per-visit quota and is queued for another visit without a new edge.
+        bool backlogged() const { return m_backlogged; }
+        void setBacklogged(bool backlogged) { m_backlogged = backlogged; }
+
+        // Rule set the current open decision was made with, so rescans only re-evaluate after rules change.
+        uint64_t ruleGeneration() const { return m_ruleGeneration; }
+        void setRuleGeneration(uint64_t generation) { m_ruleGeneration = generation; }
+
+        GroupState *group() const { return m_group.get(); }
+        void setGroup(std::shared_ptr<GroupState> group) { m_group = std::move(group); }
 
         bool operator==(const InputDevice &other) const
         {
-            if (!m_handler.empty() && m_handler == other.m_handler)
+            if (!m_info.handler.empty() || !other.m_info.handler.empty())
             {
-                return true;
+                return m_info.key == other.m_info.key && m_info.handler == other.m_info.handler;
             }
 
-            return (m_id == other.m_id);
+            return (m_info.key == other.m_info.key);
         }
 
         bool operator<(const InputDevice &other) const
@@ -147,333 +786,4202 @@ private:
 
     private:
         int         m_fd{ -1 };
-        std::string m_id;
-        std::string m_name;
-        std::string m_handler;
+        DeviceInfo  m_info;
+        std::unique_ptr<DeviceState> m_state;
+        uint32_t    m_node{ 0 };
+        bool        m_external{ false };
+        bool        m_watched{ false };
+        bool        m_backlogged{ false };
+        FloodState  m_flood;
+        uint64_t    m_ruleGeneration{ 0 };
+        std::shared_ptr<GroupState> m_group;
+
+        // N of ".../eventN"
+        static uint32_t nodeNumber(const std::string &handler)
+        {
+            size_t begin = handler.size();
+            while (begin > 0 && handler[begin - 1] >= '0' && handler[begin - 1] <= '9')
+            {
+                --begin;
+            }
+
+            return (begin < handler.size()) ? static_cast<uint32_t>(std::strtoul(handler.c_str() + begin, nullptr, 10)) : 0;
+        }
     };
 
-    static void availableInputDevices(std::vector<InputDevice> &devices)
+    // A shell style pattern reduced at compile time to the cheapest test that implements it.
+    class Glob
+    {
+    public:
+        Glob() = default;
+        explicit Glob(const std::string &pattern)
+            : m_pattern{ pattern }
+        {
+            if (pattern.empty() || pattern == "*")
+            {
+                m_kind = Kind::Any;
+                return;
+            }
+
+            const auto wildcards = pattern.find_first_of("*?[\\");
+            const auto count = std::count(pattern.begin(), pattern.end(), '*');
+
+            if (wildcards == std::string::npos)
+            {
+                m_kind = Kind::Exact;
+            }
+            else if (pattern.find_first_of("?[\\") == std::string::npos && count <= 2)
+            {
+                const bool leading = pattern.front() == '*';
+                const bool trailing = pattern.back() == '*';
+
+                if (count == 1 && trailing)
+                {
+                    m_kind = Kind::Prefix;
+                    m_pattern.pop_back();
+                }
+                else if (count == 1 && leading)
+                {
+                    m_kind = Kind::Suffix;
+                    m_pattern.erase(0, 1);
+                }
+                else if (count == 2 && leading && trailing && pattern.size() > 2)
+                {
+                    m_kind = Kind::Contains;
+                    m_pattern = pattern.substr(1, pattern.size() - 2);
+                }
+            }
+        }
+
+        bool match(const std::string &text) const
+        {
+            switch (m_kind)
+            {
+            case Kind::Any:
+                return true;
+            case Kind::Exact:
+                return text == m_pattern;
+            case Kind::Prefix:
+                return text.compare(0, m_pattern.size(), m_pattern) == 0;
+            case Kind::Suffix:
+                return text.size() >= m_pattern.size()
+                    && text.compare(text.size() - m_pattern.size(), m_pattern.size(), m_pattern) == 0;
+            case Kind::Contains:
+                return text.find(m_pattern) != std::string::npos;
+            case Kind::Pattern:
+            default:
+                return ::fnmatch(m_pattern.c_str(), text.c_str(), 0) == 0;
+            }
+        }
+
+    private:
+        enum class Kind : uint8_t
+        {
+            Any,
+            Exact,
+            Prefix,
+            Suffix,
+            Contains,
+            Pattern
+        };
+
+        Kind        m_kind{ Kind::Pattern };
+        std::string m_pattern;
+    };
+
+    class DeviceMatcher
+    {
+    public:
+        explicit DeviceMatcher(const std::vector<DeviceRule> &rules)
+        {
+            static std::atomic<uint64_t> generations{ 0 };
+            m_generation = ++generations;
+
+            m_rules.reserve(rules.size());
+            for (auto &rule : rules)
+            {
+                const int64_t numbers[]{ static_cast<int64_t>(rule.action), rule.bus, rule.vendor, rule.product, rule.classes, rule.priority };
+                m_digest = hashBytes(reinterpret_cast<const char *>(numbers), sizeof(numbers), m_digest);
+                m_digest = hashBytes(rule.name.c_str(), rule.name.size() + 1, m_digest);
+                m_digest = hashBytes(rule.phys.c_str(), rule.phys.size() + 1, m_digest);
+
+                CompiledRule compiled;
+                compiled.allow = (rule.action != DeviceRule::Action::Deny);
+                compiled.lazy = (rule.action == DeviceRule::Action::Lazy);
+                compiled.priority = rule.priority;
+                compiled.name = Glob{ rule.name };
+                compiled.phys = Glob{ rule.phys };
+                compiled.classes = rule.classes;
+                compiled.checkStrings = !rule.name.empty() || !rule.phys.empty();
+
+                // bus/vendor/product are folded into a single masked compare
+                if (rule.bus >= 0)
+                {
+                    compiled.idMask |= makeDeviceKey(0xffff, 0, 0);
+                    compiled.idValue |= makeDeviceKey(static_cast<uint16_t>(rule.bus), 0, 0);
+                }
+                if (rule.vendor >= 0)
+                {
+                    compiled.idMask |= makeDeviceKey(0, 0xffff, 0);
+                    compiled.idValue |= makeDeviceKey(0, static_cast<uint16_t>(rule.vendor), 0);
+                }
+                if (rule.product >= 0)
+                {
+                    compiled.idMask |= makeDeviceKey(0, 0, 0xffff);
+                    compiled.idValue |= makeDeviceKey(0, 0, static_cast<uint16_t>(rule.product));
+                }
+
+                m_ranked = m_ranked || compiled.lazy || compiled.priority != 0;
+                m_rules.push_back(std::move(compiled));
+            }
+        }
+
+        bool allows(const InputDevice &device) const
+        {
+            const CompiledRule *rule = match(device);
+            return (rule == nullptr) || rule->allow;
+        }
+
+        // Only meaningful when ranked(); otherwise every allowed device is eager with priority 0.
+        bool isLazy(const InputDevice &device) const
+        {
+            const CompiledRule *rule = match(device);
+            return (rule != nullptr) && rule->lazy;
+        }
+
+        int priority(const InputDevice &device) const
+        {
+            const CompiledRule *rule = match(device);
+            return (rule != nullptr) ? rule->priority : 0;
+        }
+
+        // True if any rule carries a priority or is lazy.
+        bool ranked() const { return m_ranked; }
+
+        uint64_t generation() const { return m_generation; }
+
+        // Stable across processes, so persisted decisions can be trusted while the rules are unchanged.
+        uint64_t digest() const { return m_digest; }
+
+    private:
+        struct CompiledRule
+        {
+            bool     allow{ false };
+            bool     lazy{ false };
+            bool     checkStrings{ false };
+            int      priority{ 0 };
+            uint32_t classes{ 0 };
+            uint64_t idMask{ 0 };
+            uint64_t idValue{ 0 };
+            Glob     name;
+            Glob     phys;
+        };
+
+        const CompiledRule *match(const InputDevice &device) const
+        {
+            const uint64_t key = device.key();
+            const uint32_t cls = 1u << static_cast<uint32_t>(device.deviceClass());
+
+            for (auto &rule : m_rules)
+            {
+                if ((key & rule.idMask) != rule.idValue)
+                {
+                    continue;
+                }
+
+                if (rule.classes != 0 && (rule.classes & cls) == 0)
+                {
+                    continue;
+                }
+
+                if (rule.checkStrings && (!rule.name.match(device.name()) || !rule.phys.match(device.phys())))
+                {
+                    continue;
+                }
+
+                return &rule;
+            }
+
+            return nullptr;
+        }
+
+        uint64_t                  m_generation{ 0 };
+        bool                      m_ranked{ false };
+        uint64_t                  m_digest{ 14695981039346656037ull };
+        std::vector<CompiledRule> m_rules;
+    };
+
+    // FNV-1a, used to turn identifying strings into integers once at probe time.
+    static uint64_t hashBytes(const char *data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    // Nodes of one physical device share uniq (Bluetooth address, serial), or the phys path up to the
+    // per-interface "/inputN" suffix, or the sysfs parent of their "input/inputN" directory.
+    static uint64_t groupKey(const DeviceInfo &device)
+    {
+        std::string physical;
+
+        if (!device.uniq.empty())
+        {
+            physical = device.uniq;
+        }
+        else if (!device.phys.empty())
+        {
+            physical = device.phys;
+
+            auto pos = physical.rfind("/input");
+            if (pos != std::string::npos && pos != 0)
+            {
+                physical.erase(pos);
+            }
+        }
+        else
+        {
+            physical = device.sysfs;
+
+            auto pos = physical.rfind("/input/input");
+            if (pos != std::string::npos)
+            {
+                physical.erase(pos);
+            }
+        }
+
+        const uint64_t ids = device.key & ~makeDeviceKey(0, 0, 0, 0xffff);
+        return hashBytes(physical.data(), physical.size(), ids ^ 14695981039346656037ull);
+    }
+
+    // Keeps the first node of every keyboard/pointer/touch class per group; groups made only of
+    // auxiliary nodes keep their first node. Runs on admitted nodes only, so a node that is denied or fails
+    // to open is not anyone's primary on the next rescan and a sibling takes over.
+    static void selectPrimaryNodes(std::vector<InputDevice> &devices)
+    {
+        std::vector<std::pair<uint64_t, DeviceClass>> seen;
+        std::vector<uint64_t> primaryGroups;
+
+        for (auto &device : devices)
+        {
+            if (device.deviceClass() != DeviceClass::Other && device.deviceClass() != DeviceClass::Sensor)
+            {
+                primaryGroups.push_back(device.info().group);
+            }
+        }
+
+        auto isPrimary = [&](const InputDevice &device)
+        {
+            const auto group = device.info().group;
+            const bool hasPrimary = std::find(primaryGroups.begin(), primaryGroups.end(), group) != primaryGroups.end();
+            const bool auxiliary = device.deviceClass() == DeviceClass::Other || device.deviceClass() == DeviceClass::Sensor;
+
+            if (hasPrimary && auxiliary)
+            {
+                return false;
+            }
+
+            const auto entry = std::make_pair(group, hasPrimary ? device.deviceClass() : DeviceClass::Other);
+            if (std::find(seen.begin(), seen.end(), entry) != seen.end())
+            {
+                return false;
+            }
+
+            seen.push_back(entry);
+            return true;
+        };
+
+        devices.erase(std::remove_if(devices.begin(), devices.end(), [&](const InputDevice &device){ return !isPrimary(device); }),
+                      devices.end());
+    }
+
+    // Parses a "B: XXX=" capability line: space separated hex words, most significant word first.
+    static Bitmap parseBitmap(const std::string &text)
+    {
+        Bitmap bits;
+
+        std::stringstream ss{ text };
+        std::string token;
+
+        while (ss >> token)
+        {
+            bits.push_back(std::stoul(token, nullptr, 16));
+        }
+
+        std::reverse(bits.begin(), bits.end());
+        return bits;
+    }
+
+    static DeviceClass classify(const DeviceInfo &device)
+    {
+        const auto &ev = device.ev;
+        const auto &prop = device.prop;
+        const auto &key = device.keys;
+        const auto &rel = device.rel;
+        const auto &abs = device.abs;
+
+        // Accelerometers and similar sensors stream ABS values without any buttons or relative axes.
+        if (testBit(prop, INPUT_PROP_ACCELEROMETER)
+            || (testBit(ev, EV_ABS) && !testBit(ev, EV_KEY) && !testBit(ev, EV_REL)))
+        {
+            return DeviceClass::Sensor;
+        }
+
+        const bool hasAbsPosition = testBit(abs, ABS_X) || testBit(abs, ABS_MT_POSITION_X);
+
+        // Touchpads report BTN_TOOL_FINGER and drive the cursor, touchscreens only report BTN_TOUCH.
+        if (hasAbsPosition && testBit(key, BTN_TOUCH) && !testBit(key, BTN_TOOL_FINGER))
+        {
+            return DeviceClass::Touch;
+        }
+
+        if ((testBit(rel, REL_X) && testBit(rel, REL_Y)) || testBit(key, BTN_LEFT)
+            || (hasAbsPosition && testBit(key, BTN_TOOL_FINGER)))
+        {
+            return DeviceClass::Pointer;
+        }
+
+        if (testBit(key, KEY_A) && testBit(key, KEY_Z) && testBit(key, KEY_SPACE))
+        {
+            return DeviceClass::Keyboard;
+        }
+
+        return DeviceClass::Other;
+    }
+
+    // Classifies a freshly discovered node and keeps it if it can produce user input.
+    static void addInputDevice(std::vector<InputDevice> &devices, DeviceInfo &&device)
+    {
+        const bool isInputDevice = testBit(device.ev, EV_KEY) || testBit(device.ev, EV_REL) || testBit(device.ev, EV_ABS);
+        if (isInputDevice && !device.handler.empty())
+        {
+            device.deviceClass = classify(device);
+            device.group = groupKey(device);
+            devices.emplace_back(std::move(device));
+        }
+    }
+
+    // Opening one node (and querying it) off the reader thread; some nodes block for tens of ms.
+    struct ProbeJob
+    {
+        enum State : int
+        {
+            Queued,
+            Running,
+            Done
+        };
+
+        ProbeJob(const std::string &node, bool query)
+            : handler{ node }, queryProperties{ query } {}
+        ~ProbeJob()
+        {
+            // nobody adopted the result
+            if (fd != -1)
+            {
+                ::close(fd);
+            }
+        }
+
+        void run()
+        {
+            // non-blocking so a spurious wakeup never parks the reader in read(), and kept from children
+            fd = ::open(handler.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0)
+            {
+                error = errno;
+                return;
+            }
+
+            deviceState = std::make_unique<DeviceState>();
+            deviceState->sync(fd);
+
+            if (!queryProperties)
+            {
+                return;
+            }
+
+            unsigned long props[(INPUT_PROP_CNT + sizeof(unsigned long) * 8 - 1) / (sizeof(unsigned long) * 8)]{};
+            if (::ioctl(fd, EVIOCGPROP(sizeof(props)), props) >= 0)
+            {
+                prop.assign(std::begin(props), std::end(props));
+            }
+        }
+
+        std::string                           handler;
+        bool                                  queryProperties{ true };
+        std::atomic<int>                      state{ Queued };
+        std::atomic_bool                      abandoned{ false };   // the reader stopped waiting for it
+        std::chrono::steady_clock::time_point started;              // guarded by the pool mutex
+        bool                                  stalled{ false };     // abandoned while running, same mutex
+        int                                   fd{ -1 };
+        int                                   error{ 0 };
+        Bitmap                                prop;
+        std::unique_ptr<DeviceState>          deviceState;
+    };
+
+    // Small pool of detached workers, so a node stuck in open() can never hold up stop(). A worker still
+    // running a job past its timeout does not count towards the size, so hung nodes cannot starve new ones.
+    class ProbePool
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        ProbePool()
+            : m_shared{ std::make_shared<Shared>() }
+        {
+            m_maxWorkers = std::min(std::max(std::thread::hardware_concurrency(), 2u), 8u);
+        }
+
+        ~ProbePool()
+        {
+            {
+                std::unique_lock<std::mutex> lock{ m_shared->mtx };
+                m_shared->stopping = true;
+                m_shared->queue.clear();
+            }
+            m_shared->work.notify_all();
+        }
+
+        ProbePool(const ProbePool &) = delete;
+        ProbePool &operator=(const ProbePool &) = delete;
+
+        void submit(const std::shared_ptr<ProbeJob> &job)
+        {
+            bool spawn{ false };
+            {
+                std::unique_lock<std::mutex> lock{ m_shared->mtx };
+                m_shared->queue.push_back(job);
+                spawn = needsWorker();
+            }
+
+            if (spawn)
+            {
+                std::thread{ &ProbePool::work, m_shared, m_maxWorkers }.detach();
+            }
+            m_shared->work.notify_one();
+        }
+
+        // Waits until every job finished or ran past its own timeout (counted from when a worker picked it
+        // up, or from `begin` while still queued). Jobs left running are marked abandoned.
+        void wait(const std::vector<std::shared_ptr<ProbeJob>> &jobs, Clock::time_point begin, std::chrono::milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock{ m_shared->mtx };
+            m_timeout = timeout;
+
+            // jobs queued behind workers that have stalled since they were submitted get a fresh one
+            if (needsWorker())
+            {
+                std::thread{ &ProbePool::work, m_shared, m_maxWorkers }.detach();
+            }
+            while (true)
+            {
+                const auto now = Clock::now();
+                auto next = (Clock::time_point::max)();
+
+                for (auto &job : jobs)
+                {
+                    if (job->state != ProbeJob::Done)
+                    {
+                        const auto deadline = ((job->state == ProbeJob::Running) ? job->started : begin) + timeout;
+                        if (now < deadline)
+                        {
+                            next = std::min(next, deadline);
+                        }
+                    }
+                }
+
+                if (next == (Clock::time_point::max)())
+                {
+                    break;
+                }
+
+                m_shared->done.wait_until(lock, next);
+            }
+
+            for (auto &job : jobs)
+            {
+                if (job->state != ProbeJob::Done)
+                {
+                    job->abandoned = true;
+                }
+            }
+        }
+
+        // Readable when an abandoned job finished and its result is waiting to be adopted.
+        int notifyFd() const { return m_shared->eventFd; }
+
+        void clearNotify()
+        {
+            uint64_t value;
+            while (::read(m_shared->eventFd, &value, sizeof(value)) > 0)
+            {
+            }
+        }
+
+    private:
+        // Workers update the queue and busy count under the pool mutex, so this is called with it held.
+        // Abandoned jobs still running past the timeout, including ones a worker only picked up after the
+        // reader gave up on them, stop counting towards the pool size first.
+        bool needsWorker()
+        {
+            const auto now = Clock::now();
+            for (auto &job : m_shared->running)
+            {
+                if (!job->stalled && job->abandoned && now - job->started >= m_timeout)
+                {
+                    job->stalled = true;
+                    ++m_shared->stalled;
+                }
+            }
+
+            const size_t workers = m_shared->workers;
+            const bool spawn = workers - m_shared->stalled < m_maxWorkers && workers < m_shared->queue.size() + m_shared->busy;
+            if (spawn)
+            {
+                ++m_shared->workers;
+            }
+            return spawn;
+        }
+
+        struct Shared
+        {
+            Shared() { eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); }
+            ~Shared()
+            {
+                if (eventFd != -1)
+                {
+                    ::close(eventFd);
+                }
+            }
+
+            std::mutex                            mtx;
+            std::condition_variable               work;
+            std::condition_variable               done;
+            std::deque<std::shared_ptr<ProbeJob>> queue;
+            std::vector<std::shared_ptr<ProbeJob>> running;
+            size_t                                busy{ 0 };
+            size_t                                workers{ 0 };
+            size_t                                stalled{ 0 };     // busy workers whose job was abandoned
+            bool                                  stopping{ false };
+            int                                   eventFd{ -1 };
+        };
+
+        static void work(std::shared_ptr<Shared> shared, size_t maxWorkers)
+        {
+            while (true)
+            {
+                std::shared_ptr<ProbeJob> job;
+                {
+                    std::unique_lock<std::mutex> lock{ shared->mtx };
+                    shared->work.wait(lock, [&shared]{ return shared->stopping || !shared->queue.empty(); });
+                    if (shared->stopping)
+                    {
+                        return;
+                    }
+
+                    job = std::move(shared->queue.front());
+                    shared->queue.pop_front();
+
+                    job->started = Clock::now();
+                    job->state = ProbeJob::Running;
+                    shared->running.push_back(job);
+                    ++shared->busy;
+                }
+
+                job->run();
+
+                // a worker that came back from a stalled job leaves if a replacement took its place
+                bool surplus{ false };
+                {
+                    std::unique_lock<std::mutex> lock{ shared->mtx };
+                    job->state = ProbeJob::Done;
+                    shared->running.erase(std::find(shared->running.begin(), shared->running.end(), job));
+                    --shared->busy;
+                    if (job->stalled)
+                    {
+                        --shared->stalled;
+                        surplus = shared->workers - shared->stalled > maxWorkers;
+                        if (surplus)
+                        {
+                            --shared->workers;
+                        }
+                    }
+                }
+                shared->done.notify_all();
+
+                if (job->abandoned && shared->eventFd != -1)
+                {
+                    const uint64_t one = 1;
+                    [[maybe_unused]] auto n = ::write(shared->eventFd, &one, sizeof(one));
+                }
+
+                if (surplus)
+                {
+                    return;
+                }
+            }
+        }
+
+        std::shared_ptr<Shared>   m_shared;
+        size_t                    m_maxWorkers{ 2 };
+        std::chrono::milliseconds m_timeout{ (std::chrono::milliseconds::max)() };
+    };
+
+    // Fixed size records in a small file, read and written through mmap.
+    class DeviceCache
+    {
+    public:
+        struct Entry
+        {
+            DeviceInfo info;
+            uint64_t   rdev{ 0 };
+            uint64_t   ino{ 0 };
+            bool       allowed{ true };     // rule decision, valid while the rule digest matches
+            bool       ignored{ false };    // node that cannot produce input, kept only to validate the set
+        };
+
+        static bool load(const std::string &path, uint64_t &ruleDigest, std::vector<Entry> &entries)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            struct stat st;
+            void *data = MAP_FAILED;
+            if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+            {
+                data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            ::close(fd);
+
+            if (data == MAP_FAILED)
+            {
+                return false;
+            }
+
+            const auto header = static_cast<const Header *>(data);
+            const bool valid = std::memcmp(header->magic, Magic, sizeof(header->magic)) == 0
+                            && header->version == Version && header->recordSize == sizeof(Record)
+                            && sizeof(Header) + header->count * sizeof(Record) <= static_cast<size_t>(st.st_size);
+            if (valid)
+            {
+                ruleDigest = header->ruleDigest;
+
+                auto records = reinterpret_cast<const Record *>(header + 1);
+                for (uint32_t i = 0; i < header->count; ++i)
+                {
+                    entries.push_back(fromRecord(records[i]));
+                }
+            }
+
+            ::munmap(data, static_cast<size_t>(st.st_size));
+            return valid;
+        }
+
+        // Written to a temporary file and renamed, so a concurrent start never sees a torn table.
+        // What a table is compared by, so an unchanged one is not written again.
+        static uint64_t digest(uint64_t ruleDigest, const std::vector<Entry> &entries)
+        {
+            uint64_t hash = ruleDigest;
+            for (auto &entry : entries)
+            {
+                if (entry.ignored)
+                {
+                    const uint64_t numbers[]{ entry.rdev, entry.ino, entry.ignored };
+                    hash = hashBytes(reinterpret_cast<const char *>(numbers), sizeof(numbers), hash);
+                }
+                else
+                {
+                    const uint64_t numbers[]{ entry.rdev, entry.ino, entry.info.key, static_cast<uint64_t>(entry.info.deviceClass), entry.allowed };
+                    hash = hashBytes(reinterpret_cast<const char *>(numbers), sizeof(numbers), hash);
+                }
+            }
+            return hash;
+        }
+
+        static bool save(const std::string &path, uint64_t ruleDigest, const std::vector<Entry> &entries)
+        {
+            const std::string temp{ path + ".tmp" };
+            const size_t size = sizeof(Header) + entries.size() * sizeof(Record);
+
+            int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            void *data = MAP_FAILED;
+            if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+            {
+                data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+
+            if (data == MAP_FAILED)
+            {
+                ::unlink(temp.c_str());
+                return false;
+            }
+
+            auto header = static_cast<Header *>(data);
+            std::memcpy(header->magic, Magic, sizeof(header->magic));
+            header->version = Version;
+            header->recordSize = sizeof(Record);
+            header->count = static_cast<uint32_t>(entries.size());
+            header->ruleDigest = ruleDigest;
+
+            auto records = reinterpret_cast<Record *>(header + 1);
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                toRecord(entries[i], records[i]);
+            }
+
+            ::munmap(data, size);
+            return ::rename(temp.c_str(), path.c_str()) == 0;
+        }
+
+    private:
+        static constexpr char     Magic[8]{ 'I', 'D', 'L', 'C', 'A', 'C', 'H', 'E' };
+        static constexpr uint32_t Version{ 2 };
+
+        struct Header
+        {
+            char     magic[8];
+            uint32_t version;
+            uint32_t recordSize;
+            uint32_t count;
+            uint32_t reserved;
+            uint64_t ruleDigest;
+        };
+
+        template <size_t Bits>
+        using Words = std::array<uint64_t, (Bits + 63) / 64>;
+
+        struct Record
+        {
+            uint64_t       rdev;
+            uint64_t       ino;
+            uint64_t       key;
+            uint64_t       group;
+            uint8_t        deviceClass;
+            uint8_t        allowed;
+            uint8_t        ignored;
+            uint8_t        reserved[5];
+            char           name[128];
+            char           phys[64];
+            char           uniq[64];
+            char           sysfs[192];
+            char           handler[64];
+            Words<INPUT_PROP_CNT> prop;
+            Words<EV_CNT>  ev;
+            Words<KEY_CNT> keys;
+            Words<REL_CNT> rel;
+            Words<ABS_CNT> abs;
+            Words<MSC_CNT> msc;
+            Words<SW_CNT>  sw;
+            Words<LED_CNT> led;
+            Words<SND_CNT> snd;
+            Words<FF_CNT>  ff;
+        };
+
+        template <size_t N>
+        static void copyString(char (&dst)[N], const std::string &src)
+        {
+            std::memset(dst, 0, N);
+            std::memcpy(dst, src.c_str(), std::min(src.size(), N - 1));
+        }
+
+        template <size_t N>
+        static std::string readString(const char (&src)[N])
+        {
+            return std::string{ src, ::strnlen(src, N) };
+        }
+
+        template <size_t N>
+        static void toWords(std::array<uint64_t, N> &dst, const Bitmap &src)
+        {
+            dst.fill(0);
+            for (size_t bit = 0; bit < N * 64; ++bit)
+            {
+                if (testBit(src, static_cast<int>(bit)))
+                {
+                    dst[bit / 64] |= 1ull << (bit % 64);
+                }
+            }
+        }
+
+        template <size_t N>
+        static Bitmap fromWords(const std::array<uint64_t, N> &src)
+        {
+            const size_t wordBits = sizeof(unsigned long) * 8;
+
+            Bitmap dst((N * 64 + wordBits - 1) / wordBits, 0);
+            for (size_t bit = 0; bit < N * 64; ++bit)
+            {
+                if ((src[bit / 64] >> (bit % 64)) & 1ull)
+                {
+                    dst[bit / wordBits] |= 1UL << (bit % wordBits);
+                }
+            }
+
+            return dst;
+        }
+
+        static void toRecord(const Entry &entry, Record &record)
+        {
+            const auto &info = entry.info;
+
+            record.rdev = entry.rdev;
+            record.ino = entry.ino;
+            record.key = info.key;
+            record.group = info.group;
+            record.deviceClass = static_cast<uint8_t>(info.deviceClass);
+            record.allowed = entry.allowed ? 1 : 0;
+            record.ignored = entry.ignored ? 1 : 0;
+            std::memset(record.reserved, 0, sizeof(record.reserved));
+            copyString(record.name, info.name);
+            copyString(record.phys, info.phys);
+            copyString(record.uniq, info.uniq);
+            copyString(record.sysfs, info.sysfs);
+            copyString(record.handler, info.handler);
+            toWords(record.prop, info.prop);
+            toWords(record.ev, info.ev);
+            toWords(record.keys, info.keys);
+            toWords(record.rel, info.rel);
+            toWords(record.abs, info.abs);
+            toWords(record.msc, info.msc);
+            toWords(record.sw, info.sw);
+            toWords(record.led, info.led);
+            toWords(record.snd, info.snd);
+            toWords(record.ff, info.ff);
+        }
+
+        static Entry fromRecord(const Record &record)
+        {
+            Entry entry;
+            auto &info = entry.info;
+
+            entry.rdev = record.rdev;
+            entry.ino = record.ino;
+            entry.allowed = record.allowed != 0;
+            entry.ignored = record.ignored != 0;
+            info.key = record.key;
+            info.group = record.group;
+            info.deviceClass = static_cast<DeviceClass>(std::min<uint8_t>(record.deviceClass, static_cast<uint8_t>(DeviceClass::Other)));
+            info.name = readString(record.name);
+            info.phys = readString(record.phys);
+            info.uniq = readString(record.uniq);
+            info.sysfs = readString(record.sysfs);
+            info.handler = readString(record.handler);
+            info.prop = fromWords(record.prop);
+            info.ev = fromWords(record.ev);
+            info.keys = fromWords(record.keys);
+            info.rel = fromWords(record.rel);
+            info.abs = fromWords(record.abs);
+            info.msc = fromWords(record.msc);
+            info.sw = fromWords(record.sw);
+            info.led = fromWords(record.led);
+            info.snd = fromWords(record.snd);
+            info.ff = fromWords(record.ff);
+
+            return entry;
+        }
+    };
+
+    // What discovery remembers between rescans.
+    struct DiscoveryState
+    {
+        std::unordered_map<std::string, DeviceInfo> known;  // sysfs: event name -> info of the current node
+        std::vector<InputDevice> sysfsDevices;              // sysfs: the input nodes of `known`, classified once
+        uint64_t contentHash{ 0 };                          // procfs: hash of the last reconciled file
+        bool     dirty{ true };                             // options changed or a device went away
+
+        // Nodes that failed to open, keyed by (st_rdev, st_ino) so a replugged node is tried right away.
+        struct FailedOpen
+        {
+            std::string                           handler;
+            int                                   error{ 0 };
+            unsigned                              attempts{ 0 };
+            std::chrono::steady_clock::time_point retryAt;
+        };
+        std::unordered_map<uint64_t, FailedOpen> failed;
+
+        ProbePool probes;
+        std::unordered_map<std::string, std::shared_ptr<ProbeJob>> probing;   // handler -> job that outlived its timeout
+
+        // warm start: the persisted table, used for the first rescan only if every node still matches
+        std::vector<DeviceCache::Entry> warm;
+        uint64_t warmRuleDigest{ 0 };
+        std::unordered_map<std::string, bool> warmDecisions;   // handler -> cached rule decision
+
+        std::vector<DeviceInfo> skipped;                        // allowed but left closed by the fd budget
+
+        // nodes probed and then refused by the sensor filter or the rules, kept out of primary node selection
+        // and the budget; valid for one rule generation and sensor setting
+        std::unordered_map<std::string, uint64_t> rejected;    // handler -> node key
+        std::pair<uint64_t, bool> rejectedFor{ 0, false };
+        uint64_t cacheHash{ 0 };                                // what was last written
+
+        // phases of the last full rescan
+        std::chrono::steady_clock::duration discoveryTime{ 0 };
+        std::chrono::steady_clock::duration parseTime{ 0 };
+        std::chrono::steady_clock::duration openTime{ 0 };
+
+        static uint64_t nodeKey(const std::string &handler)
+        {
+            struct stat st;
+            if (::stat(handler.c_str(), &st) != 0)
+            {
+                return 0;
+            }
+
+            return (static_cast<uint64_t>(st.st_rdev) << 32) ^ static_cast<uint64_t>(st.st_ino);
+        }
+
+        bool shouldRetry(uint64_t key) const
+        {
+            auto it = failed.find(key);
+            return it == failed.end() || std::chrono::steady_clock::now() >= it->second.retryAt;
+        }
+
+        // Backs off 1 s, 2 s, 4 s ... up to 5 minutes; only the first failure of a node is reported.
+        void recordFailure(uint64_t key, const std::string &handler, int error)
+        {
+            auto &entry = failed[key];
+            if (entry.attempts == 0 || entry.error != error)
+            {
+                std::fprintf(stderr, "%s: %s, retrying with backoff\n", handler.c_str(), std::strerror(error));
+            }
+
+            entry.handler = handler;
+            entry.error = error;
+            const auto backoff = std::chrono::seconds{ 1LL << std::min(entry.attempts, 9u) };
+            entry.retryAt = std::chrono::steady_clock::now() + std::min(backoff, std::chrono::seconds{ 300 });
+            ++entry.attempts;
+        }
+
+        // Permissions or ownership of the node changed: forget its backoff.
+        void clearFailure(const std::string &node)
+        {
+            for (auto it = failed.begin(); it != failed.end(); )
+            {
+                const auto &handler = it->second.handler;
+                const bool matches = handler.size() > node.size() && handler[handler.size() - node.size() - 1] == '/'
+                                  && handler.compare(handler.size() - node.size(), node.size(), node) == 0;
+                it = matches ? failed.erase(it) : std::next(it);
+            }
+        }
+
+        std::chrono::steady_clock::time_point nextRetry() const
+        {
+            auto next = (std::chrono::steady_clock::time_point::max)();
+            for (auto &entry : failed)
+            {
+                next = std::min(next, entry.second.retryAt);
+            }
+
+            return next;
+        }
+    };
+
+    static bool readAttribute(const std::string &path, std::string &value)
+    {
+        std::ifstream ifs{ path, std::ios::in };
+        if (!ifs.is_open() || !std::getline(ifs, value))
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    static uint16_t readIdAttribute(const std::string &path)
+    {
+        std::string value;
+        if (!readAttribute(path, value) || value.empty())
+        {
+            return 0;
+        }
+
+        return static_cast<uint16_t>(std::stoul(value, nullptr, 16));
+    }
+
+    // Brings state.known and state.sysfsDevices up to date, reading and classifying only nodes that are new or
+    // now belong to another device; returns false when no node changed.
+    static bool availableInputDevicesSysfs(DiscoveryState &state)
+    {
+        const static std::string classPath{ "/sys/class/input/" };
+        const static std::string devicePath{ "/dev/input/" };
+
+        const static std::array<std::pair<std::string, Bitmap DeviceInfo::*>, 8> bitmaps{ {
+            { "key", &DeviceInfo::keys },
+            { "rel", &DeviceInfo::rel },
+            { "abs", &DeviceInfo::abs },
+            { "msc", &DeviceInfo::msc },
+            { "sw", &DeviceInfo::sw },
+            { "led", &DeviceInfo::led },
+            { "snd", &DeviceInfo::snd },
+            { "ff", &DeviceInfo::ff },
+        } };
+
+        DIR *dir = ::opendir(classPath.c_str());
+        if (dir == nullptr)
+        {
+            return false;
+        }
+
+        std::vector<std::string> seen;
+        std::vector<std::string> changed;   // handlers of nodes added, replaced or gone
+        std::vector<DeviceInfo> added;
+        while (auto entry = ::readdir(dir))
+        {
+            const std::string node{ entry->d_name };
+            if (node.find("event") != 0)
+            {
+                continue;
+            }
+
+            // ../../devices/<parent>/input/inputN/eventM, where inputN changes on every plug
+            char link[PATH_MAX];
+            auto len = ::readlink((classPath + node).c_str(), link, sizeof(link) - 1);
+            if (len <= 0)
+            {
+                continue;
+            }
+
+            std::string sysfs{ link, static_cast<size_t>(len) };
+            sysfs.erase(0, sysfs.find("/devices/"));
+            sysfs.erase(sysfs.rfind('/'));
+
+            seen.push_back(node);
+            auto it = state.known.find(node);
+            if (it != state.known.end() && it->second.sysfs == sysfs)
+            {
+                continue;
+            }
+
+            const std::string base{ classPath + node + "/device/" };
+
+            DeviceInfo device;
+            device.sysfs = sysfs;
+            device.handler = devicePath + node;
+
+            std::string value;
+            if (readAttribute(base + "capabilities/ev", value))
+            {
+                device.ev = parseBitmap(value);
+            }
+
+            // nodes that cannot produce input are remembered without reading anything else
+            if (testBit(device.ev, EV_KEY) || testBit(device.ev, EV_REL) || testBit(device.ev, EV_ABS))
+            {
+                readAttribute(base + "name", device.name);
+                readAttribute(base + "phys", device.phys);
+                readAttribute(base + "uniq", device.uniq);
+
+                device.key = makeDeviceKey(readIdAttribute(base + "id/bustype"), readIdAttribute(base + "id/vendor"),
+                                           readIdAttribute(base + "id/product"), readIdAttribute(base + "id/version"));
+
+                if (readAttribute(base + "properties", value))
+                {
+                    device.prop = parseBitmap(value);
+                }
+
+                for (auto &bitmap : bitmaps)
+                {
+                    if (readAttribute(base + "capabilities/" + bitmap.first, value))
+                    {
+                        device.*bitmap.second = parseBitmap(value);
+                    }
+                }
+            }
+
+            changed.push_back(device.handler);
+            added.push_back(device);
+            state.known[node] = std::move(device);
+        }
+        ::closedir(dir);
+
+        for (auto it = state.known.begin(); it != state.known.end(); )
+        {
+            if (std::find(seen.begin(), seen.end(), it->first) == seen.end())
+            {
+                changed.push_back(it->second.handler);
+                it = state.known.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        if (changed.empty())
+        {
+            return false;
+        }
+
+        auto &devices = state.sysfsDevices;
+        devices.erase(std::remove_if(devices.begin(), devices.end(), [&changed](const InputDevice &device)
+                                     { return std::find(changed.begin(), changed.end(), device.info().handler) != changed.end(); }),
+                      devices.end());
+        for (auto &device : added)
+        {
+            addInputDevice(devices, std::move(device));
+        }
+        return true;
+    }
+
+    static bool readDevicesFile(std::string &content)
+    {
+        const static std::string devicesFile{ "/proc/bus/input/devices" };
+
+        std::ifstream ifs{ devicesFile, std::ios::in };
+        if (!ifs.is_open())
+        {
+            return false;
+        }
+
+        ifs >> std::noskipws;
+
+        content.assign(std::istream_iterator<char>{ ifs }, std::istream_iterator<char>{});
+        ifs.close();
+
+        return true;
+    }
+
+    static void availableInputDevices(std::vector<InputDevice> &devices, const std::string &content)
+    {
+        const static std::string devicePath{ "/dev/input/" };
+
+        const static std::string idPrefix{ "I: " };
+        const static std::string namePrefix{ "N: Name=" };
+        const static std::string physPrefix{ "P: Phys=" };
+        const static std::string sysfsPrefix{ "S: Sysfs=" };
+        const static std::string uniqPrefix{ "U: Uniq=" };
+        const static std::string handlerPrefix{ "H: Handlers=" };
+        const static std::string bitmapPrefix{ "B: " };
+
+        const static std::array<std::pair<std::string, Bitmap DeviceInfo::*>, 10> bitmaps{ {
+            { "PROP=", &DeviceInfo::prop },
+            { "EV=", &DeviceInfo::ev },
+            { "KEY=", &DeviceInfo::keys },
+            { "REL=", &DeviceInfo::rel },
+            { "ABS=", &DeviceInfo::abs },
+            { "MSC=", &DeviceInfo::msc },
+            { "SW=", &DeviceInfo::sw },
+            { "LED=", &DeviceInfo::led },
+            { "SND=", &DeviceInfo::snd },
+            { "FF=", &DeviceInfo::ff },
+        } };
+
+        std::vector<std::string> deviceInfo;
+        {
+            const std::string sep{ "\n\n" };
+
+            size_t begin = 0;
+            size_t end = 0;
+            std::string token;
+
+            while ((end = content.find(sep, begin)) != std::string::npos)
+            {
+                token = content.substr(begin, end - begin);
+                if (!token.empty())
+                {
+                    begin += token.length();
+                    deviceInfo.push_back(std::move(token));
+                }
+                begin += sep.length();
+            }
+        }
+
+        for (auto &info : deviceInfo)
+        {
+            std::vector<std::string> props;
+            {
+                std::stringstream ss{ info };
+                std::string token;
+
+                while (std::getline(ss, token, '\n'))
+                {
+                    if (!token.empty())
+                    {
+                        props.push_back(std::move(token));
+                    }
+                }
+            }
+
+            if (props.empty())
+            {
+                continue;
+            }
+
+            DeviceInfo device;
+
+            for (auto &prop : props)
+            {
+                if (prop.find(idPrefix) == 0)
+                {
+                    unsigned int bus = 0, vendor = 0, product = 0, version = 0;
+                    if (std::sscanf(prop.c_str() + idPrefix.length(), "Bus=%x Vendor=%x Product=%x Version=%x", &bus, &vendor, &product, &version) == 4)
+                    {
+                        device.key = makeDeviceKey(static_cast<uint16_t>(bus), static_cast<uint16_t>(vendor),
+                                                   static_cast<uint16_t>(product), static_cast<uint16_t>(version));
+                    }
+                }
+                else if (prop.find(namePrefix) == 0)
+                {
+                    device.name = prop.substr(namePrefix.length());
+                    if (!device.name.empty())
+                    {
+                        device.name.erase(0, device.name.find_first_not_of('\"'));
+                        device.name.erase(device.name.find_last_not_of('\"') + 1);
+                    }
+                }
+                else if (prop.find(physPrefix) == 0)
+                {
+                    device.phys = prop.substr(physPrefix.length());
+                }
+                else if (prop.find(sysfsPrefix) == 0)
+                {
+                    device.sysfs = prop.substr(sysfsPrefix.length());
+                }
+                else if (prop.find(uniqPrefix) == 0)
+                {
+                    device.uniq = prop.substr(uniqPrefix.length());
+                }
+                else if (prop.find(handlerPrefix) == 0)
+                {
+                    std::stringstream ss{ prop.substr(handlerPrefix.length()) };
+                    std::string token;
+
+                    while (std::getline(ss, token, ' '))
+                    {
+                        if (!token.empty() && token.find("event") == 0)
+                        {
+                            device.handler = devicePath + token;
+                            break;
+                        }
+                    }
+                }
+                else if (prop.find(bitmapPrefix) == 0)
+                {
+                    for (auto &bitmap : bitmaps)
+                    {
+                        if (prop.compare(bitmapPrefix.length(), bitmap.first.length(), bitmap.first) == 0)
+                        {
+                            device.*bitmap.second = parseBitmap(prop.substr(bitmapPrefix.length() + bitmap.first.length()));
+                            break;
+                        }
+                    }
+                }
+            }
+
+            addInputDevice(devices, std::move(device));
+        }
+    }
+
+    // Watches the device directory and coalesces node notifications into storms.
+    class HotplugMonitor
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        HotplugMonitor() = default;
+        ~HotplugMonitor()
+        {
+            if (m_fd != -1)
+            {
+                ::close(m_fd);
+            }
+        }
+
+        HotplugMonitor(const HotplugMonitor &) = delete;
+        HotplugMonitor &operator=(const HotplugMonitor &) = delete;
+
+        // (Re)arms the watch; the directory may not exist until the first device appears.
+        bool watch()
+        {
+            const static std::string devicePath{ "/dev/input/" };
+
+            if (m_fd == -1)
+            {
+                m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (m_fd == -1)
+                {
+                    return false;
+                }
+            }
+
+            if (m_wd == -1)
+            {
+                m_wd = ::inotify_add_watch(m_fd, devicePath.c_str(), IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM);
+            }
+
+            return m_wd != -1;
+        }
+
+        int fd() const { return (m_wd != -1) ? m_fd : -1; }
+        size_t pending() const { return m_pending; }
+
+        void drain(std::chrono::milliseconds window)
+        {
+            alignas(struct inotify_event) char buffer[4096];
+
+            ssize_t n;
+            while ((n = ::read(m_fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char *ptr = buffer; ptr < buffer + n; )
+                {
+                    auto event = reinterpret_cast<const struct inotify_event *>(ptr);
+                    ptr += sizeof(struct inotify_event) + event->len;
+
+                    if (event->mask & IN_IGNORED)
+                    {
+                        m_wd = -1;
+                        note(window);
+                    }
+                    else if (event->len > 0 && std::strncmp(event->name, "event", 5) == 0)
+                    {
+                        if (event->mask & IN_ATTRIB)
+                        {
+                            m_changed.emplace_back(event->name);
+                        }
+                        note(window);
+                    }
+                }
+            }
+        }
+
+        // The storm is over once the window passed without notifications, or after eight windows at most.
+        Clock::time_point deadline() const { return m_deadline; }
+        bool expired(Clock::time_point now) const { return m_pending > 0 && now >= m_deadline; }
+
+        void reset() { m_pending = 0; }
+
+        // Nodes whose attributes (mode, owner, ACL) changed since the last call.
+        std::vector<std::string> takeChanged()
+        {
+            std::vector<std::string> changed;
+            changed.swap(m_changed);
+            return changed;
+        }
+
+    private:
+        void note(std::chrono::milliseconds window)
+        {
+            const auto now = Clock::now();
+            if (m_pending++ == 0)
+            {
+                m_first = now;
+            }
+
+            m_deadline = std::min(now + window, m_first + window * 8);
+        }
+
+        int               m_fd{ -1 };
+        int               m_wd{ -1 };
+        size_t            m_pending{ 0 };
+        Clock::time_point m_first;
+        Clock::time_point m_deadline;
+        std::vector<std::string> m_changed;
+    };
+
+    // Hierarchical timing wheel: four levels of 64 slots over 10 ms ticks, so arming, cancelling and expiring
+    // a timer are O(1) and one kernel timer aimed at nextTick() drives any number of them. Timers further out
+    // than the top level (about 7.7 days) sit in its last slot and are re-placed when it cascades.
+    // Timers are numbered by the owner, which keeps whatever they stand for in a parallel array.
+    class TimingWheel
+    {
+    public:
+        static constexpr uint64_t tickMs = 10;
+        static constexpr uint64_t never = UINT64_MAX;
+
+        explicit TimingWheel(uint64_t nowMs) : m_now{ nowMs / tickMs }
+        {
+            m_heads.fill(npos);
+        }
+
+        uint64_t now() const { return m_now; }
+
+        bool armed(uint32_t timer) const { return timer < m_timers.size() && m_timers[timer].level != unarmed; }
+
+        // Deadlines already due land in the next tick.
+        void arm(uint32_t timer, uint64_t deadlineMs)
+        {
+            if (timer >= m_timers.size())
+            {
+                m_timers.resize(timer + 1);
+            }
+            cancel(timer);
+            m_timers[timer].deadline = std::max((deadlineMs + tickMs - 1) / tickMs, m_now + 1);
+            place(timer);
+        }
+
+        void cancel(uint32_t timer)
+        {
+            if (!armed(timer))
+            {
+                return;
+            }
+
+            Timer &entry = m_timers[timer];
+            const size_t head = entry.level * slots + entry.slot;
+            if (entry.prev != npos)
+            {
+                m_timers[entry.prev].next = entry.next;
+            }
+            else
+            {
+                m_heads[head] = entry.next;
+                if (entry.next == npos)
+                {
+                    m_occupied[entry.level] &= ~(1ull << entry.slot);
+                }
+            }
+            if (entry.next != npos)
+            {
+                m_timers[entry.next].prev = entry.prev;
+            }
+            entry.level = unarmed;
+        }
+
+        // First tick at which advance() has something to do, or `never`.
+        uint64_t nextTick() const
+        {
+            uint64_t next = never;
+            for (uint32_t level = 0; level < levels; ++level)
+            {
+                if (m_occupied[level] == 0)
+                {
+                    continue;
+                }
+
+                // distance to the next occupied slot, counting the current one as a full turn away
+                const uint64_t base = m_now >> (level * slotBits);
+                const uint32_t shift = static_cast<uint32_t>((base + 1) & (slots - 1));
+                const uint64_t rotated = (shift == 0) ? m_occupied[level]
+                                                      : (m_occupied[level] >> shift) | (m_occupied[level] << (slots - shift));
+                const uint64_t distance = static_cast<uint64_t>(__builtin_ctzll(rotated)) + 1;
+                next = std::min(next, (base + distance) << (level * slotBits));
+            }
+            return next;
+        }
+
+        // Moves time forward to nowMs, jumping over ticks where nothing happens, and appends the timers
+        // that came due; they are no longer armed.
+        void advance(uint64_t nowMs, std::vector<uint32_t> &expired)
+        {
+            const uint64_t target = nowMs / tickMs;
+            while (m_now < target)
+            {
+                const uint64_t next = nextTick();
+                if (next > target)
+                {
+                    m_now = target;
+                    break;
+                }
+                m_now = next;
+
+                // a higher slot is handed down once every level below it has wrapped
+                for (uint32_t level = 1; level < levels; ++level)
+                {
+                    if ((m_now & ((1ull << (level * slotBits)) - 1)) != 0)
+                    {
+                        break;
+                    }
+                    const uint32_t slot = static_cast<uint32_t>((m_now >> (level * slotBits)) & (slots - 1));
+                    for (uint32_t timer = take(level, slot); timer != npos; )
+                    {
+                        const uint32_t following = m_timers[timer].next;
+                        if (m_timers[timer].deadline <= m_now)
+                        {
+                            expired.push_back(timer);
+                        }
+                        else
+                        {
+                            place(timer);
+                        }
+                        timer = following;
+                    }
+                }
+
+                for (uint32_t timer = take(0, static_cast<uint32_t>(m_now & (slots - 1))); timer != npos; timer = m_timers[timer].next)
+                {
+                    expired.push_back(timer);
+                }
+            }
+        }
+
+    private:
+        static constexpr uint32_t slotBits = 6;
+        static constexpr uint32_t slots = 1u << slotBits;
+        static constexpr uint32_t levels = 4;
+        static constexpr uint32_t npos = UINT32_MAX;
+        static constexpr uint8_t unarmed = 0xff;
+
+        struct Timer
+        {
+            uint64_t deadline{ 0 };     // in ticks
+            uint32_t prev{ npos };
+            uint32_t next{ npos };
+            uint8_t  level{ unarmed };
+            uint8_t  slot{ 0 };
+        };
+
+        void place(uint32_t timer)
+        {
+            Timer &entry = m_timers[timer];
+            const uint64_t delta = std::min<uint64_t>(entry.deadline - m_now, (1ull << (levels * slotBits)) - 1);
+            uint32_t level = 0;
+            while ((delta >> ((level + 1) * slotBits)) != 0)
+            {
+                ++level;
+            }
+
+            entry.level = static_cast<uint8_t>(level);
+            entry.slot = static_cast<uint8_t>(((m_now + delta) >> (level * slotBits)) & (slots - 1));
+            const size_t head = level * slots + entry.slot;
+            entry.prev = npos;
+            entry.next = m_heads[head];
+            if (entry.next != npos)
+            {
+                m_timers[entry.next].prev = timer;
+            }
+            m_heads[head] = timer;
+            m_occupied[level] |= 1ull << entry.slot;
+        }
+
+        // Unlinks a whole slot and returns its first timer; `next` stays valid for walking it.
+        uint32_t take(uint32_t level, uint32_t slot)
+        {
+            const size_t head = level * slots + slot;
+            const uint32_t first = m_heads[head];
+            m_heads[head] = npos;
+            m_occupied[level] &= ~(1ull << slot);
+            for (uint32_t timer = first; timer != npos; timer = m_timers[timer].next)
+            {
+                m_timers[timer].level = unarmed;
+            }
+            return first;
+        }
+
+        uint64_t m_now;
+        std::vector<Timer> m_timers;
+        std::array<uint32_t, levels * slots> m_heads;
+        std::array<uint64_t, levels> m_occupied{};
+    };
+
+    // Single-producer, multi-consumer broadcast ring after the LMAX disruptor: the reader writes each event
+    // once and every consumer reads it in place through its own cursor. The producer keeps a cached bound on
+    // the slowest cursor and only scans the cursors again when that bound says the ring is full; it never
+    // waits, so an event that still finds no room is dropped and counted. The first event published after a
+    // drop is preceded by an EV_SYN/SYN_DROPPED carrying its device fields, telling every consumer that the
+    // stream has a gap and state tracked from it must be rebuilt.
+    class BroadcastRing
+    {
+    public:
+        static constexpr size_t maxConsumers = 64;
+
+        explicit BroadcastRing(size_t capacity)
+        {
+            size_t size = 64;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            m_slots.resize(size);
+            m_mask = size - 1;
+        }
+
+        // Reader thread only.
+        void publish(const InputEvent &event)
+        {
+            const uint64_t needed = m_gap ? 2 : 1;
+            if (m_next + needed - m_gate > m_mask + 1)
+            {
+                m_gate = slowest();
+                if (m_next + needed - m_gate > m_mask + 1)
+                {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    m_gap = true;
+                    return;
+                }
+            }
+
+            if (m_gap)
+            {
+                InputEvent &marker = m_slots[m_next++ & m_mask];
+                marker = event;
+                marker.type = EV_SYN;
+                marker.code = SYN_DROPPED;
+                marker.value = 0;
+                m_gap = false;
+            }
+            m_slots[m_next & m_mask] = event;
+            m_published.store(++m_next, std::memory_order_release);
+        }
+
+        uint64_t published() const { return m_published.load(std::memory_order_acquire); }
+        uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+        size_t consumers() const { return static_cast<size_t>(__builtin_popcountll(m_open.load())); }
+
+        // New consumers start at the next event published; returns -1 when every cursor is taken. `owner` is
+        // checked by owns() so that one listener cannot read or close another's stream.
+        int open(const void *owner)
+        {
+            std::unique_lock<std::mutex> lock{ m_openMtx };
+            const uint64_t open = m_open.load();
+            if (open == ~0ull)
+            {
+                return -1;
+            }
+
+            const int slot = __builtin_ctzll(~open);
+            m_cursors[slot].position.store(published());
+            m_cursors[slot].owner.store(owner);
+            m_open.store(open | (1ull << slot));
+            return slot;
+        }
+
+        void close(int slot)
+        {
+            std::unique_lock<std::mutex> lock{ m_openMtx };
+            m_open.fetch_and(~(1ull << slot));
+            m_cursors[slot].owner.store(nullptr);
+        }
+
+        bool owns(int slot, const void *owner) const
+        {
+            return slot >= 0 && static_cast<size_t>(slot) < maxConsumers && (m_open.load() & (1ull << slot)) != 0
+                && m_cursors[slot].owner.load() == owner;
+        }
+
+        bool pending(int slot) const
+        {
+            return m_cursors[slot].position.load(std::memory_order_relaxed) != published();
+        }
+
+        // Hands up to `max` unread events to batch(events, count) as at most two contiguous runs, the second
+        // one after the ring wraps, then moves the cursor past them. One thread per consumer.
+        template <typename Batch>
+        size_t read(int slot, Batch &&batch, size_t max)
+        {
+            Cursor &cursor = m_cursors[slot];
+            const uint64_t from = cursor.position.load(std::memory_order_relaxed);
+            const uint64_t to = from + std::min<uint64_t>(published() - from, max);
+            for (uint64_t at = from; at < to; )
+            {
+                const size_t index = static_cast<size_t>(at & m_mask);
+                const size_t run = static_cast<size_t>(std::min<uint64_t>(to - at, m_slots.size() - index));
+                batch(&m_slots[index], run);
+                at += run;
+            }
+            cursor.position.store(to, std::memory_order_release);
+            return static_cast<size_t>(to - from);
+        }
+
+    private:
+        struct alignas(64) Cursor
+        {
+            std::atomic<uint64_t> position{ 0 };
+            std::atomic<const void *> owner{ nullptr };
+        };
+
+        // With no consumer open nothing gates the producer.
+        uint64_t slowest() const
+        {
+            uint64_t gate = m_next;
+            for (uint64_t open = m_open.load(); open != 0; open &= open - 1)
+            {
+                gate = std::min(gate, m_cursors[__builtin_ctzll(open)].position.load(std::memory_order_acquire));
+            }
+            return gate;
+        }
+
+        std::vector<InputEvent> m_slots;
+        uint64_t m_mask{ 0 };
+        uint64_t m_next{ 0 };       // producer's own copies of the sequence and the slowest-cursor bound
+        uint64_t m_gate{ 0 };
+        bool m_gap{ false };        // an event was dropped since the last one published
+        alignas(64) std::atomic<uint64_t> m_published{ 0 };
+        std::atomic<uint64_t> m_dropped{ 0 };
+        std::atomic<uint64_t> m_open{ 0 };
+        std::mutex m_openMtx;
+        std::array<Cursor, maxConsumers> m_cursors;
+    };
+
+    struct ScanOptions
+    {
+        bool includeSensors{ false };
+        bool primaryNodesOnly{ false };
+        DiscoverySource source{ DiscoverySource::ProcFs };
+        std::chrono::milliseconds probeTimeout{ 250 };
+        std::shared_ptr<const DeviceMatcher> matcher;
+        std::string cachePath;
+        size_t fdBudget{ 0 };                   // 0 picks one from RLIMIT_NOFILE
+        uint32_t demandedClasses{ 0 };          // classes started subscribers ask for, opens lazy devices
+    };
+
+    // Without an explicit budget the listener takes a quarter of the soft fd limit, leaving the rest to the
+    // host process.
+    static size_t automaticFdBudget()
+    {
+        struct rlimit limit;
+        if (::getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+        {
+            return SIZE_MAX;
+        }
+
+        return std::max<size_t>(static_cast<size_t>(limit.rlim_cur) / 4, 1);
+    }
+
+    // Order in which devices get a slot of the fd budget: rule priority, then activity classes first.
+    static void sortByPriority(std::vector<InputDevice> &devices, const DeviceMatcher &matcher)
+    {
+        static constexpr int classRank[]{ 0, 1, 2, 4, 3 };     // Keyboard, Pointer, Touch, Sensor, Other
+
+        std::vector<std::pair<std::pair<int, int>, size_t>> order;
+        order.reserve(devices.size());
+        for (size_t i = 0; i < devices.size(); ++i)
+        {
+            const int priority = matcher.ranked() ? matcher.priority(devices[i]) : 0;
+            order.push_back({ { -priority, classRank[static_cast<size_t>(devices[i].deviceClass())] }, i });
+        }
+        std::stable_sort(order.begin(), order.end(), [](const auto &a, const auto &b){ return a.first < b.first; });
+
+        std::vector<InputDevice> sorted;
+        sorted.reserve(devices.size());
+        for (auto &entry : order)
+        {
+            sorted.push_back(std::move(devices[entry.second]));
+        }
+        devices.swap(sorted);
+    }
+
+    static bool statNode(const std::string &handler, uint64_t &rdev, uint64_t &ino)
+    {
+        struct stat st;
+        if (::stat(handler.c_str(), &st) != 0)
+        {
+            return false;
+        }
+
+        rdev = static_cast<uint64_t>(st.st_rdev);
+        ino = static_cast<uint64_t>(st.st_ino);
+        return true;
+    }
+
+    static bool listEventNodes(std::vector<std::string> &nodes)
     {
-        const static std::string devicesFile{ "/proc/bus/input/devices" };
         const static std::string devicePath{ "/dev/input/" };
 
-        const static std::string idPrefix{ "I: " };
-        const static std::string namePrefix{ "N: Name=" };
-        const static std::string handlerPrefix{ "H: Handlers=" };
-        const static std::string eventPrefix{ "B: EV=" };
+        DIR *dir = ::opendir(devicePath.c_str());
+        if (dir == nullptr)
+        {
+            return false;
+        }
+
+        while (auto entry = ::readdir(dir))
+        {
+            if (std::strncmp(entry->d_name, "event", 5) == 0)
+            {
+                nodes.push_back(devicePath + entry->d_name);
+            }
+        }
+        ::closedir(dir);
+        return true;
+    }
+
+    // Rebuilds the device list from the persisted table if every event node under /dev/input is still the
+    // node that was cached (same st_rdev and st_ino), which costs one readdir and a stat per node. Nodes that
+    // cannot produce input (lid switches, PC speakers, jacks) are in the table too, marked ignored.
+    static bool warmInputDevices(std::vector<InputDevice> &devices, DiscoveryState &discovery)
+    {
+        std::vector<DeviceCache::Entry> warm;
+        warm.swap(discovery.warm);
+
+        std::vector<std::string> nodes;
+        if (!listEventNodes(nodes))
+        {
+            return false;
+        }
+
+        for (auto &node : nodes)
+        {
+            uint64_t rdev = 0, ino = 0;
+            auto it = std::find_if(warm.begin(), warm.end(), [&node](const DeviceCache::Entry &entry){ return entry.info.handler == node; });
+            if (it == warm.end() || !statNode(node, rdev, ino) || rdev != it->rdev || ino != it->ino)
+            {
+                return false;
+            }
+        }
+
+        for (auto &entry : warm)
+        {
+            if (std::find(nodes.begin(), nodes.end(), entry.info.handler) == nodes.end())
+            {
+                return false;
+            }
+        }
+
+        for (auto &entry : warm)
+        {
+            if (!entry.ignored)
+            {
+                discovery.warmDecisions.emplace(entry.info.handler, entry.allowed);
+                devices.emplace_back(std::move(entry.info));
+            }
+        }
+
+        return true;
+    }
+
+    static void saveDeviceCache(const std::string &path, const std::vector<InputDevice> &allDevices,
+                                const std::vector<InputDevice> &opened, const DeviceMatcher &matcher, DiscoveryState &discovery)
+    {
+        std::vector<DeviceCache::Entry> entries;
+        entries.reserve(allDevices.size());
+
+        for (auto &device : allDevices)
+        {
+            DeviceCache::Entry entry;
+            if (!statNode(device.info().handler, entry.rdev, entry.ino))
+            {
+                continue;
+            }
+
+            // opened devices carry what probing learned, and are judged by it
+            auto it = std::find_if(opened.begin(), opened.end(), [&device](const InputDevice &dev){ return dev == device; });
+            const InputDevice &known = (it != opened.end()) ? *it : device;
+            entry.info = known.info();
+            entry.allowed = matcher.allows(known);
+            entries.push_back(std::move(entry));
+        }
+
+        // the remaining event nodes only have to be the same nodes next time
+        std::vector<std::string> nodes;
+        listEventNodes(nodes);
+        for (auto &node : nodes)
+        {
+            const bool listed = std::any_of(entries.begin(), entries.end(),
+                                            [&node](const DeviceCache::Entry &entry){ return entry.info.handler == node; });
+            DeviceCache::Entry entry;
+            if (listed || !statNode(node, entry.rdev, entry.ino))
+            {
+                continue;
+            }
+
+            entry.info.handler = node;
+            entry.allowed = false;
+            entry.ignored = true;
+            entries.push_back(std::move(entry));
+        }
+
+        const uint64_t hash = DeviceCache::digest(matcher.digest(), entries);
+        if (hash != discovery.cacheHash && DeviceCache::save(path, matcher.digest(), entries))
+        {
+            discovery.cacheHash = hash;
+        }
+    }
+
+    // Returns false when nothing changed since the previous call and the device set was left untouched.
+    static bool openInputDevices(std::vector<InputDevice> &devices, const ScanOptions &options, DiscoveryState &discovery)
+    {
+        const bool includeSensors = options.includeSensors;
+        const DeviceMatcher &matcher = *options.matcher;
+
+        std::vector<InputDevice> parsed;
+        std::vector<InputDevice> openedDevices;
+        bool fromSysfs{ false };
+
+        const auto discoveryBegin = std::chrono::steady_clock::now();
+        auto parseBegin = discoveryBegin;
+        if (!discovery.warm.empty() && discovery.warmRuleDigest == matcher.digest() && warmInputDevices(parsed, discovery))
+        {
+            parseBegin = std::chrono::steady_clock::now();
+        }
+        else if (options.source == DiscoverySource::SysFs)
+        {
+            const bool changed = availableInputDevicesSysfs(discovery);
+            if (!discovery.dirty && !changed)
+            {
+                return false;
+            }
+
+            parseBegin = std::chrono::steady_clock::now();
+            fromSysfs = true;
+        }
+        else
+        {
+            std::string content;
+            readDevicesFile(content);
+
+            const auto hash = hashBytes(content.data(), content.size());
+            if (!discovery.dirty && hash == discovery.contentHash)
+            {
+                return false;
+            }
+
+            parseBegin = std::chrono::steady_clock::now();
+            discovery.contentHash = hash;
+            availableInputDevices(parsed, content);
+        }
+        discovery.discoveryTime = parseBegin - discoveryBegin;
+
+        // sysfs keeps its list across rescans and only patches the nodes that changed
+        const std::vector<InputDevice> &allDevices = fromSysfs ? discovery.sysfsDevices : parsed;
+
+        discovery.dirty = false;
+
+        if (discovery.rejectedFor != std::make_pair(matcher.generation(), includeSensors))
+        {
+            discovery.rejected.clear();
+            discovery.rejectedFor = { matcher.generation(), includeSensors };
+        }
+
+        // admission comes first, so primary node selection and the budget only see nodes that can stay open;
+        // open devices are judged by what probing learned about them
+        std::vector<InputDevice> admitted;
+        for (auto &candidate : allDevices)
+        {
+            auto dIt = std::find_if(devices.begin(), devices.end(), [&candidate](const InputDevice &dev){ return candidate == dev; });
+            const bool isOpened = (dIt != devices.end() && dIt->isOpened());
+            const InputDevice &device = isOpened ? *dIt : candidate;
+
+            if (!includeSensors && device.deviceClass() == DeviceClass::Sensor)
+            {
+                continue;
+            }
+
+            if (matcher.ranked() && matcher.isLazy(device)
+                && (options.demandedClasses & (1u << static_cast<uint32_t>(device.deviceClass()))) == 0)
+            {
+                continue;
+            }
+
+            if (isOpened)
+            {
+                if (dIt->ruleGeneration() != matcher.generation() && !matcher.allows(*dIt))
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                const auto &handler = candidate.info().handler;
+                auto warm = discovery.warmDecisions.find(handler);
+                if ((warm != discovery.warmDecisions.end()) ? !warm->second : !matcher.allows(candidate))
+                {
+                    continue;
+                }
+
+                // a probe that outlived its timeout is adopted whatever its node did since
+                if (discovery.probing.count(handler) == 0)
+                {
+                    const auto nodeKey = DiscoveryState::nodeKey(handler);
+                    auto rIt = discovery.rejected.find(handler);
+                    if ((rIt != discovery.rejected.end() && rIt->second == nodeKey) || !discovery.shouldRetry(nodeKey))
+                    {
+                        continue;
+                    }
+                }
+            }
+
+            admitted.emplace_back(device.info());
+        }
+
+        if (options.primaryNodesOnly)
+        {
+            selectPrimaryNodes(admitted);
+        }
+
+        // devices take budget slots in priority order, so a new keyboard can displace an open auxiliary node;
+        // a slot taken by a node that then fails or is refused after probing is handed on by a rescan
+        sortByPriority(admitted, matcher);
+        const size_t budget = (options.fdBudget != 0) ? options.fdBudget : automaticFdBudget();
+        size_t used{ 0 };
+        discovery.skipped.clear();
+
+        // new nodes are opened concurrently, so the slowest node bounds the rescan instead of their sum
+        const auto probeBegin = std::chrono::steady_clock::now();
+        discovery.parseTime = probeBegin - parseBegin;
+        std::vector<std::shared_ptr<ProbeJob>> jobs;
+        std::vector<InputDevice> candidates;
+
+        for (auto &device : admitted)
+        {
+            const auto &handler = device.info().handler;
+            auto dIt = std::find_if(devices.begin(), devices.end(), [&device](const InputDevice &dev){ return device == dev; });
+            if (dIt != devices.end() && dIt->isOpened())
+            {
+                if (used >= budget)
+                {
+                    discovery.skipped.push_back(dIt->info());
+                    continue;
+                }
+                ++used;
+
+                dIt->setRuleGeneration(matcher.generation());
+                openedDevices.push_back(std::move(*dIt));
+                continue;
+            }
+
+            // a probe that timed out earlier is still running or has a result to adopt
+            auto pIt = discovery.probing.find(handler);
+            if (used >= budget)
+            {
+                if (pIt != discovery.probing.end())
+                {
+                    discovery.probing.erase(pIt);
+                }
+                discovery.skipped.push_back(device.info());
+                continue;
+            }
+            ++used;
+
+            if (pIt != discovery.probing.end())
+            {
+                if (pIt->second->state == ProbeJob::Done)
+                {
+                    jobs.push_back(std::move(pIt->second));
+                    candidates.emplace_back(device.info());
+                    discovery.probing.erase(pIt);
+                }
+                continue;
+            }
+
+            const bool isWarm = discovery.warmDecisions.count(handler) > 0;
+            auto job = std::make_shared<ProbeJob>(handler, !isWarm);
+            discovery.probes.submit(job);
+            jobs.push_back(std::move(job));
+            candidates.emplace_back(device.info());
+        }
+
+        discovery.probes.wait(jobs, probeBegin, options.probeTimeout);
+
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            auto &job = jobs[i];
+            auto &device = candidates[i];
+
+            if (job->state != ProbeJob::Done)
+            {
+                discovery.probing.emplace(job->handler, std::move(job));
+                continue;
+            }
+
+            const auto nodeKey = DiscoveryState::nodeKey(job->handler);
+            if (job->fd == -1)
+            {
+                if (nodeKey != 0)
+                {
+                    discovery.recordFailure(nodeKey, job->handler, job->error);
+
+                    // the failed node now waits out its backoff; its slot and, with primary nodes only, its
+                    // place in the group go to the next candidate
+                    discovery.dirty = discovery.dirty || !discovery.skipped.empty() || options.primaryNodesOnly;
+                }
+                continue;
+            }
+            discovery.failed.erase(nodeKey);
+
+            device.adopt(job->fd, job->prop, std::move(job->deviceState));
+            job->fd = -1;
+
+            // warm devices were already decided with their probed class
+            const bool isWarm = discovery.warmDecisions.count(device.info().handler) > 0;
+            if ((!includeSensors && device.deviceClass() == DeviceClass::Sensor) || (!isWarm && !matcher.allows(device)))
+            {
+                // remembered, so on the next rescan it holds no budget slot and a sibling can stand in as the
+                // group's primary node; that rescan comes right away if someone is waiting for either
+                device.close();
+                if (nodeKey != 0)
+                {
+                    discovery.rejected[device.info().handler] = nodeKey;
+                    discovery.dirty = discovery.dirty || !discovery.skipped.empty() || options.primaryNodesOnly;
+                }
+                continue;
+            }
+            device.setRuleGeneration(matcher.generation());
+
+            openedDevices.push_back(std::move(device));
+        }
+
+        // attached devices are not subject to discovery, rules or the budget
+        for (auto &device : devices)
+        {
+            if (device.external() && device.fd() != -1)
+            {
+                openedDevices.push_back(std::move(device));
+            }
+        }
+
+        // forget probes of nodes that are gone, their fds are closed with the job
+        for (auto it = discovery.probing.begin(); it != discovery.probing.end(); )
+        {
+            const auto &handler = it->first;
+            const bool present = std::any_of(allDevices.begin(), allDevices.end(),
+                                             [&handler](const InputDevice &device){ return device.info().handler == handler; });
+            it = present ? std::next(it) : discovery.probing.erase(it);
+        }
+
+        // and backoff entries of nodes that are gone
+        for (auto it = discovery.failed.begin(); it != discovery.failed.end(); )
+        {
+            const auto &handler = it->second.handler;
+            const bool present = std::any_of(allDevices.begin(), allDevices.end(),
+                                             [&handler](const InputDevice &device){ return device.info().handler == handler; });
+            it = present ? std::next(it) : discovery.failed.erase(it);
+        }
+
+        for (auto it = discovery.rejected.begin(); it != discovery.rejected.end(); )
+        {
+            const auto &handler = it->first;
+            const bool present = std::any_of(allDevices.begin(), allDevices.end(),
+                                             [&handler](const InputDevice &device){ return device.info().handler == handler; });
+            it = present ? std::next(it) : discovery.rejected.erase(it);
+        }
+
+        if (!options.cachePath.empty())
+        {
+            saveDeviceCache(options.cachePath, allDevices, openedDevices, matcher, discovery);
+        }
+        discovery.warm.clear();
+        discovery.warmDecisions.clear();
+
+        devices.swap(openedDevices);
+
+        discovery.openTime = std::chrono::steady_clock::now() - probeBegin;
+        return true;
+    }
+
+#endif
+
+    // Reader thread, device fds and everything they feed. An exclusive listener owns one; shared listeners
+    // attach to the process-wide one and only keep their own running flag and subscriptions.
+    class Core
+    {
+    public:
+        Core()
+        {
+#if defined(__linux__)
+            m_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            m_idleTimerFd = ::timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+        }
+        ~Core()
+        {
+            shutdown();
+#if defined(__linux__)
+            for (auto &entry : m_attachQueue)
+            {
+                ::close(entry.first);
+            }
+            if (m_wakeFd != -1)
+            {
+                ::close(m_wakeFd);
+            }
+            if (m_idleTimerFd != -1)
+            {
+                ::close(m_idleTimerFd);
+            }
+            delete m_ring.load();
+#endif
+        }
+
+        Core(const Core &) = delete;
+        Core &operator=(const Core &) = delete;
+
+        static std::shared_ptr<Core> shared()
+        {
+            static std::mutex mtx;
+            static std::weak_ptr<Core> instance;
+
+            std::unique_lock<std::mutex> lock{ mtx };
+            auto core = instance.lock();
+            if (!core)
+            {
+                core = std::make_shared<Core>();
+                instance = core;
+            }
+            return core;
+        }
+
+        // The first started view starts the reader, the last stopped view stops it.
+        bool attach()
+        {
+            std::unique_lock<std::mutex> lock{ m_viewMtx };
+            if (m_views == 0 && !listen())
+            {
+                return false;
+            }
+            ++m_views;
+            updatePaused();
+            return true;
+        }
+
+        void detach()
+        {
+            std::unique_lock<std::mutex> lock{ m_viewMtx };
+            if (m_views > 0 && --m_views == 0)
+            {
+                shutdown();
+            }
+            updatePaused();
+        }
+
+        void pauseView()
+        {
+            std::unique_lock<std::mutex> lock{ m_viewMtx };
+            ++m_pausedViews;
+            updatePaused();
+        }
+
+        void resumeView()
+        {
+            std::unique_lock<std::mutex> lock{ m_viewMtx };
+            --m_pausedViews;
+            updatePaused();
+        }
+
+        time_t lastOperateTime() const { return m_lastOperateTime; }
+
+        time_t lastOperateTime(DeviceClass cls) const
+        {
+            if (cls >= DeviceClass::Count)
+            {
+                return 0;
+            }
+
+            return m_classOperateTime[static_cast<size_t>(cls)];
+        }
+
+        uint64_t activitySequence() const { return m_activitySeq.load(); }
+
+        bool waitForActivity(uint64_t since, std::chrono::milliseconds timeout, const std::atomic_bool &viewRunning)
+        {
+            const bool infinite = (timeout == (std::chrono::milliseconds::max)());
+            const auto deadline = infinite ? (std::chrono::steady_clock::time_point::max)()
+                                           : std::chrono::steady_clock::now() + timeout;
+
+            m_activityWaiters.fetch_add(1);
+            bool changed{ false };
+            while (true)
+            {
+                // read the wake word first so a stamp or stop after the checks below fails the futex compare
+                const uint32_t word = m_wakeWord.load();
+                if (!viewRunning)
+                {
+                    break;
+                }
+
+                if (m_activitySeq.load() != since)
+                {
+                    changed = true;
+                    break;
+                }
+
+                auto remaining = (std::chrono::milliseconds::max)();
+                if (!infinite)
+                {
+                    remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    if (remaining.count() <= 0)
+                    {
+                        break;
+                    }
+                }
+
+                waitOnWord(word, remaining);
+            }
+            m_activityWaiters.fetch_sub(1);
+
+            return changed;
+        }
+
+        // Releases waitForActivity() callers so they re-check their view's running flag.
+        void releaseWaiters()
+        {
+            m_wakeWord.fetch_add(1);
+            wakeWordWaiters();
+        }
+
+        // Makes the reader pick up changed settings now rather than at its next timeout.
+        void requestRescan()
+        {
+            m_rescanRequested = true;
+            wakeReader();
+        }
+
+        void setSensorsEnabled(bool enabled)
+        {
+            if (m_sensorsEnabled.exchange(enabled) != enabled)
+            {
+                requestRescan();
+            }
+        }
+        bool sensorsEnabled() const { return m_sensorsEnabled; }
+
+        bool isReady() const { return m_isReady; }
+
+        bool waitUntilReady(std::chrono::milliseconds timeout) const
+        {
+            std::unique_lock<std::mutex> lock{ m_readyMtx };
+            return m_readyCv.wait_for(lock, timeout, [this]{ return m_isReady || !m_isRunning; }) && m_isReady;
+        }
+
+        StartupMetrics startupMetrics() const
+        {
+            std::unique_lock<std::mutex> lock{ m_readyMtx };
+            return m_startupMetrics;
+        }
+
+#if defined(__linux__)
+        std::vector<DeviceInfo> devices() const
+        {
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            return m_deviceInfos;
+        }
+
+        std::vector<DeviceGroup> deviceGroups() const
+        {
+            std::vector<DeviceGroup> groups;
+
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            for (auto &info : m_deviceInfos)
+            {
+                auto it = std::find_if(groups.begin(), groups.end(), [&info](const DeviceGroup &group){ return group.id == info.group; });
+                if (it == groups.end())
+                {
+                    auto state = m_groupStates.find(info.group);
+
+                    DeviceGroup group;
+                    group.id = info.group;
+                    group.name = info.name;
+                    if (state != m_groupStates.end())
+                    {
+                        group.events = state->second->events.load(std::memory_order_relaxed);
+                        group.lastOperateTime = state->second->lastOperateTime.load(std::memory_order_relaxed);
+                    }
+                    groups.push_back(std::move(group));
+                    it = std::prev(groups.end());
+                }
+                it->handlers.push_back(info.handler);
+            }
+
+            return groups;
+        }
+
+        void setPrimaryNodesOnly(bool enabled)
+        {
+            if (m_primaryNodesOnly.exchange(enabled) != enabled)
+            {
+                requestRescan();
+            }
+        }
+        bool primaryNodesOnly() const { return m_primaryNodesOnly; }
+
+        void setDiscoverySource(DiscoverySource source)
+        {
+            if (m_discoverySource.exchange(source) != source)
+            {
+                requestRescan();
+            }
+        }
+        DiscoverySource discoverySource() const { return m_discoverySource; }
+
+        void setDeviceCachePath(const std::string &path)
+        {
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            m_cachePath = path;
+        }
+
+        void setProbeTimeout(std::chrono::milliseconds timeout) { m_probeTimeoutMs = timeout.count(); }
+        std::chrono::milliseconds probeTimeout() const { return std::chrono::milliseconds{ m_probeTimeoutMs.load() }; }
+
+        void setHotplugWindow(std::chrono::milliseconds window) { m_hotplugWindowMs = window.count(); }
+        std::chrono::milliseconds hotplugWindow() const { return std::chrono::milliseconds{ m_hotplugWindowMs.load() }; }
+
+        HotplugStats hotplugStats() const
+        {
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            return m_hotplugStats;
+        }
+
+        SuspendStats suspendStats() const
+        {
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            return m_suspendStats;
+        }
+
+        DiscoveryStats discoveryStats() const
+        {
+            DiscoveryStats stats;
+            stats.fullRescans = m_fullRescans;
+            stats.skippedRescans = m_skippedRescans;
+            return stats;
+        }
+
+        void setDeviceRules(const std::vector<DeviceRule> &rules)
+        {
+            auto matcher = std::make_shared<const DeviceMatcher>(rules);
+            {
+                std::unique_lock<std::mutex> lock{ m_configMtx };
+                m_matcher = std::move(matcher);
+            }
+            requestRescan();
+        }
+
+        void setFdBudget(size_t devices)
+        {
+            if (m_fdBudget.exchange(devices) != devices)
+            {
+                requestRescan();
+            }
+        }
+        size_t fdBudget() const { return m_fdBudget; }
+
+        std::vector<DeviceInfo> skippedDevices() const
+        {
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            return m_skippedInfos;
+        }
+
+        void setEventFilters(uint32_t filters) { m_eventFilters = filters; }
+        uint32_t eventFilters() const { return m_eventFilters; }
+
+        FilterStats filterStats() const
+        {
+            FilterStats stats;
+            stats.autorepeat = m_suppressedRepeats.load(std::memory_order_relaxed);
+            stats.unchanged = m_suppressedUnchanged.load(std::memory_order_relaxed);
+            stats.emptyFrames = m_suppressedFrames.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        void setFloodPolicy(const FloodPolicy &policy)
+        {
+            m_floodRate = policy.maxEventsPerSecond;
+            m_floodFrames = policy.maxIdenticalFrames;
+            m_quarantineMs = policy.quarantine.count();
+        }
+
+        FloodPolicy floodPolicy() const
+        {
+            FloodPolicy policy;
+            policy.maxEventsPerSecond = m_floodRate;
+            policy.maxIdenticalFrames = m_floodFrames;
+            policy.quarantine = std::chrono::milliseconds{ m_quarantineMs.load() };
+            return policy;
+        }
+
+        void setQuarantineHandler(QuarantineHandler handler)
+        {
+            std::unique_lock<std::mutex> lock{ m_dispatchMtx };
+            m_quarantineHandler = std::move(handler);
+        }
+
+        FloodStats floodStats() const
+        {
+            FloodStats stats;
+            stats.quarantines = m_quarantines.load(std::memory_order_relaxed);
+            stats.releases = m_releases.load(std::memory_order_relaxed);
+            stats.quarantined = stats.quarantines - stats.releases;
+            return stats;
+        }
+
+        void setEdgeTriggered(bool enabled) { m_edgeTriggered = enabled; }
+        bool edgeTriggered() const { return m_edgeTriggered; }
+
+        bool attachDevice(int fd, DeviceInfo info)
+        {
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock{ m_configMtx };
+                m_attachQueue.emplace_back(fd, std::move(info));
+            }
+            requestRescan();
+            return true;
+        }
+
+        int subscribe(EventHandler handler, uint32_t classes, uint32_t types, std::vector<uint16_t> codes,
+                      const std::atomic_bool *active)
+        {
+            int id{ 0 };
+            {
+                std::unique_lock<std::mutex> lock{ m_dispatchMtx };
+                id = m_nextSubscription++;
+                m_subscribers.push_back(Subscription{ id, std::move(handler), classes, types, std::move(codes), active });
+                m_subscriberCount = static_cast<uint32_t>(m_subscribers.size());
+                m_router.build(m_subscribers);
+            }
+            {
+                std::unique_lock<std::mutex> lock{ m_demandMtx };
+                m_demands.push_back(Demand{ id, classes, active });
+            }
+            refreshDemand();
+            return id;
+        }
+
+        // Dispatch holds the same lock, so the handler is not running once this returns.
+        void unsubscribe(int id)
+        {
+            std::unique_lock<std::mutex> lock{ m_dispatchMtx };
+            m_subscribers.erase(std::remove_if(m_subscribers.begin(), m_subscribers.end(),
+                                               [id](const Subscription &subscription){ return subscription.id == id; }),
+                                m_subscribers.end());
+            m_subscriberCount = static_cast<uint32_t>(m_subscribers.size());
+            m_router.build(m_subscribers);
+            lock.unlock();
+
+            {
+                std::unique_lock<std::mutex> demandLock{ m_demandMtx };
+                m_demands.erase(std::remove_if(m_demands.begin(), m_demands.end(), [id](const Demand &demand){ return demand.id == id; }),
+                                m_demands.end());
+            }
+            refreshDemand();
+        }
+
+        // Recomputes the classes started subscribers ask for; lazy devices follow on the next rescan. Sensors
+        // are only demanded by name, like the default classes of idle timers. Kept apart from the dispatch
+        // lock, so handlers can pause and resume their listener.
+        void refreshDemand()
+        {
+            std::unique_lock<std::mutex> lock{ m_demandMtx };
+            uint32_t demanded{ 0 };
+            for (auto &demand : m_demands)
+            {
+                if (*demand.active)
+                {
+                    demanded |= (demand.classes != 0) ? demand.classes : ~(1u << static_cast<uint32_t>(DeviceClass::Sensor));
+                }
+            }
+
+            if (m_demandedClasses.exchange(demanded) != demanded)
+            {
+                requestRescan();
+            }
+        }
+
+        int addIdleTimer(std::chrono::milliseconds threshold, IdleHandler handler, uint32_t classes, const std::atomic_bool *active)
+        {
+            if (m_idleTimerFd == -1 || !handler || threshold.count() <= 0)
+            {
+                return 0;
+            }
+
+            std::unique_lock<std::mutex> lock{ m_idleMtx };
+            uint32_t slot = static_cast<uint32_t>(m_idleSlots.size());
+            if (!m_freeIdleSlots.empty())
+            {
+                slot = m_freeIdleSlots.back();
+                m_freeIdleSlots.pop_back();
+            }
+            else
+            {
+                m_idleSlots.emplace_back();
+            }
+
+            IdleTimer &timer = m_idleSlots[slot];
+            timer.id = m_nextIdleTimer++;
+            timer.threshold = threshold;
+            timer.classes = (classes != 0) ? classes : ~(1u << static_cast<uint32_t>(DeviceClass::Sensor));
+            timer.handler = std::move(handler);
+            timer.active = active;
+            timer.since = idleClockMs();
+            timer.idle = false;
+            m_idleWheel.arm(slot, timer.since + static_cast<uint64_t>(threshold.count()));
+            ++m_idleTimerCount;
+            programIdleTimerFd();
+            return timer.id;
+        }
+
+        void setStreamCapacity(size_t events)
+        {
+            std::unique_lock<std::mutex> lock{ m_streamMtx };
+            m_streamCapacity = events;
+        }
+
+        // The ring is created by the first stream and kept; the reader only touches it once a stream is open.
+        int openStream(const void *owner)
+        {
+            std::unique_lock<std::mutex> lock{ m_streamMtx };
+            if (m_ring.load() == nullptr)
+            {
+                m_ring.store(new BroadcastRing{ m_streamCapacity });
+            }
+
+            const int slot = m_ring.load()->open(owner);
+            if (slot < 0)
+            {
+                return 0;
+            }
+            m_streamConsumers.fetch_add(1, std::memory_order_release);
+            return slot + 1;
+        }
+
+        void closeStream(int id, const void *owner)
+        {
+            std::unique_lock<std::mutex> lock{ m_streamMtx };
+            BroadcastRing *ring = streamRing(id, owner);
+            if (ring != nullptr)
+            {
+                ring->close(id - 1);
+                m_streamConsumers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        size_t readStream(int id, const void *owner, const StreamBatch &batch, size_t max)
+        {
+            BroadcastRing *ring = streamRing(id, owner);
+            return (ring != nullptr) ? ring->read(id - 1, batch, max) : 0;
+        }
+
+        bool waitStream(int id, const void *owner, std::chrono::milliseconds timeout,
+                        const std::atomic_bool &viewRunning)
+        {
+            BroadcastRing *ring = streamRing(id, owner);
+            if (ring == nullptr)
+            {
+                return false;
+            }
+
+            const bool infinite = (timeout == (std::chrono::milliseconds::max)());
+            const auto deadline = infinite ? (std::chrono::steady_clock::time_point::max)()
+                                           : std::chrono::steady_clock::now() + timeout;
+
+            // shares the activity wake word; the reader bumps it after publishing while anyone waits
+            m_activityWaiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool pending{ false };
+            while (true)
+            {
+                const uint32_t word = m_wakeWord.load();
+                if (ring->pending(id - 1))
+                {
+                    pending = true;
+                    break;
+                }
+
+                if (!viewRunning)
+                {
+                    break;
+                }
+
+                auto remaining = (std::chrono::milliseconds::max)();
+                if (!infinite)
+                {
+                    remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    if (remaining.count() <= 0)
+                    {
+                        break;
+                    }
+                }
+                waitOnWord(word, remaining);
+            }
+            m_activityWaiters.fetch_sub(1);
+            return pending;
+        }
+
+        StreamStats streamStats() const
+        {
+            StreamStats stats;
+            if (const BroadcastRing *ring = m_ring.load())
+            {
+                stats.published = ring->published();
+                stats.dropped = ring->dropped();
+                stats.consumers = ring->consumers();
+            }
+            return stats;
+        }
+
+        // Expiry holds the same lock, so the handler is not running once this returns.
+        // A started or resumed listener may have timers that came due while it could not be told. The reader
+        // picks them up, so this is safe from handlers that run under the idle lock.
+        void recheckIdleTimers()
+        {
+            if (m_idleTimerCount.load(std::memory_order_relaxed) > 0)
+            {
+                m_idleRecheck = true;
+                wakeReader();
+            }
+        }
+
+        void removeIdleTimer(int id)
+        {
+            std::unique_lock<std::mutex> lock{ m_idleMtx };
+            for (uint32_t slot = 0; slot < m_idleSlots.size(); ++slot)
+            {
+                IdleTimer &timer = m_idleSlots[slot];
+                if (timer.id != id)
+                {
+                    continue;
+                }
+
+                m_idleWheel.cancel(slot);
+                if (timer.deferred)
+                {
+                    m_idleDeferred.erase(std::remove(m_idleDeferred.begin(), m_idleDeferred.end(), slot), m_idleDeferred.end());
+                }
+                if (timer.idle)
+                {
+                    m_idleNow.erase(std::remove(m_idleNow.begin(), m_idleNow.end(), slot), m_idleNow.end());
+                    setIdle(slot, false);
+                }
+                timer = IdleTimer{};
+                m_freeIdleSlots.push_back(slot);
+                --m_idleTimerCount;
+                programIdleTimerFd();
+                return;
+            }
+        }
+#endif
+
+    private:
+#if defined(__linux__)
+        // Stream ids are core-wide; a view only gets the ring for cursors it opened.
+        BroadcastRing *streamRing(int id, const void *owner) const
+        {
+            BroadcastRing *ring = m_ring.load(std::memory_order_acquire);
+            return (ring != nullptr && ring->owns(id - 1, owner)) ? ring : nullptr;
+        }
+
+        // Wakes waitStream() once per reader pass rather than per event.
+        void notifyStream()
+        {
+            const uint64_t published = m_ring.load(std::memory_order_acquire)->published();
+            if (published != m_streamNotified)
+            {
+                m_streamNotified = published;
+
+                // the ring's release store does not order the waiter check after it; waitStream() fences the
+                // other way round, so either it sees the events or the reader sees it waiting
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_activityWaiters.load() > 0)
+                {
+                    m_wakeWord.fetch_add(1);
+                    wakeWordWaiters();
+                }
+            }
+        }
+
+        struct IdleTimer
+        {
+            int                       id{ 0 };
+            std::chrono::milliseconds threshold{ 0 };
+            uint32_t                  classes{ 0 };
+            IdleHandler               handler;
+            const std::atomic_bool   *active{ nullptr };
+            uint64_t                  since{ 0 };       // last input counted, or when armed, in idle clock ms
+            bool                      idle{ false };
+            bool                      deferred{ false };    // came due while its listener was inactive
+        };
+
+        // CLOCK_BOOTTIME, so time spent suspended counts as idle.
+        static uint64_t idleClockMs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_BOOTTIME, &now);
+            return static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000;
+        }
+
+        // Input only stamps the per-class clock; timers look at it when they come due and re-arm themselves
+        // if there was input since. Only timers that are already idle are touched here. Reader thread.
+        void noteIdleActivity(DeviceClass cls)
+        {
+            const uint64_t now = idleClockMs();
+            const size_t index = static_cast<size_t>(cls);
+            m_idleActivity[index].store(now, std::memory_order_relaxed);
+            if (m_idleWaiting[index].load(std::memory_order_relaxed) == 0)
+            {
+                return;
+            }
+
+            const uint32_t bit = 1u << static_cast<uint32_t>(cls);
+            std::unique_lock<std::mutex> lock{ m_idleMtx };
+            for (size_t i = 0; i < m_idleNow.size(); )
+            {
+                const uint32_t slot = m_idleNow[i];
+                IdleTimer &timer = m_idleSlots[slot];
+                if ((timer.classes & bit) == 0 || !*timer.active)
+                {
+                    ++i;
+                    continue;
+                }
+
+                m_idleNow[i] = m_idleNow.back();
+                m_idleNow.pop_back();
+                setIdle(slot, false);
+                notifyIdle(timer, false, now - timer.since);
+                timer.since = now;
+                m_idleWheel.arm(slot, now + static_cast<uint64_t>(timer.threshold.count()));
+            }
+            programIdleTimerFd();
+        }
+
+        // The timerfd fired: advance the wheel and either re-arm each due timer from its latest input or
+        // report it idle. Reader thread.
+        void expireIdleTimers()
+        {
+            uint64_t expirations;
+            while (::read(m_idleTimerFd, &expirations, sizeof(expirations)) > 0)
+            {
+            }
+
+            std::unique_lock<std::mutex> lock{ m_idleMtx };
+            const uint64_t now = idleClockMs();
+            m_idleExpired.clear();
+            m_idleWheel.advance(now, m_idleExpired);
+            for (auto slot : m_idleExpired)
+            {
+                IdleTimer &timer = m_idleSlots[slot];
+                uint64_t last = timer.since;
+                for (size_t cls = 0; cls < m_idleActivity.size(); ++cls)
+                {
+                    if (timer.classes & (1u << cls))
+                    {
+                        last = std::max(last, m_idleActivity[cls].load(std::memory_order_relaxed));
+                    }
+                }
+
+                timer.since = last;
+                const uint64_t deadline = last + static_cast<uint64_t>(timer.threshold.count());
+                if (deadline > now)
+                {
+                    m_idleWheel.arm(slot, deadline);
+                    continue;
+                }
+
+                // not idle until its listener can be told; rearmDeferredIdleTimers() picks it up again
+                if (!*timer.active)
+                {
+                    timer.deferred = true;
+                    m_idleDeferred.push_back(slot);
+                    continue;
+                }
+
+                setIdle(slot, true);
+                m_idleNow.push_back(slot);
+                notifyIdle(timer, true, now - last);
+            }
+            programIdleTimerFd();
+        }
+
+        // Arms deferred timers whose listener is active again for when they would have come due, or right
+        // away if that has passed, rather than a whole threshold after the listener came back. Reader thread.
+        void rearmDeferredIdleTimers()
+        {
+            std::unique_lock<std::mutex> lock{ m_idleMtx };
+            const uint64_t now = idleClockMs();
+            for (size_t i = 0; i < m_idleDeferred.size(); )
+            {
+                const uint32_t slot = m_idleDeferred[i];
+                IdleTimer &timer = m_idleSlots[slot];
+                if (!*timer.active)
+                {
+                    ++i;
+                    continue;
+                }
+
+                m_idleDeferred[i] = m_idleDeferred.back();
+                m_idleDeferred.pop_back();
+                timer.deferred = false;
+                m_idleWheel.arm(slot, std::max(timer.since + static_cast<uint64_t>(timer.threshold.count()), now));
+            }
+            programIdleTimerFd();
+        }
+
+        // Keeps the per-class count of idle timers that input has to wake; called with m_idleMtx held.
+        void setIdle(uint32_t slot, bool idle)
+        {
+            IdleTimer &timer = m_idleSlots[slot];
+            timer.idle = idle;
+            for (size_t cls = 0; cls < m_idleWaiting.size(); ++cls)
+            {
+                if (timer.classes & (1u << cls))
+                {
+                    m_idleWaiting[cls].fetch_add(idle ? 1u : ~0u, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Transitions only happen while the timer's listener is active, so idle=true and idle=false pair up.
+        void notifyIdle(const IdleTimer &timer, bool idle, uint64_t idleForMs)
+        {
+            IdleEvent event;
+            event.id = timer.id;
+            event.idle = idle;
+            event.idleFor = std::chrono::milliseconds{ idleForMs };
+            timer.handler(event);
+        }
+
+        // Aims the one timerfd at the wheel's next tick; called with m_idleMtx held.
+        void programIdleTimerFd()
+        {
+            const uint64_t next = m_idleWheel.nextTick();
+            if (next == m_idleFdTick)
+            {
+                return;
+            }
+            m_idleFdTick = next;
+
+            struct itimerspec spec{};
+            if (next != TimingWheel::never)
+            {
+                const uint64_t ms = next * TimingWheel::tickMs;
+                spec.it_value.tv_sec = static_cast<time_t>(ms / 1000);
+                spec.it_value.tv_nsec = static_cast<long>(ms % 1000) * 1000000;
+            }
+            ::timerfd_settime(m_idleTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        }
+
+        struct Subscription
+        {
+            int                     id{ 0 };
+            EventHandler            handler;
+            uint32_t                classes{ 0 };
+            uint32_t                types{ 0 };
+            std::vector<uint16_t>   codes;
+            const std::atomic_bool *active{ nullptr };     // running flag of the subscribing listener
+        };
 
-        const static std::array<int, 4> bits{ 0x01, 0x02, 0x04, 0x88 };
+        // The classes a subscription asks for, under m_demandMtx.
+        struct Demand
+        {
+            int                     id{ 0 };
+            uint32_t                classes{ 0 };
+            const std::atomic_bool *active{ nullptr };
+        };
 
-        std::ifstream ifs{ devicesFile, std::ios::in };
-        if (!ifs.is_open())
+        // Which subscribers want a (class, type, code), rebuilt on every subscription change so dispatch is a
+        // table load and a walk over set bits however many subscribers there are. Sets are bitsets over
+        // m_subscribers, `m_words` words each, kept in one pool; set 0 is the empty one.
+        class EventRouter
+        {
+        public:
+            void build(const std::vector<Subscription> &subscribers)
+            {
+                m_words = (subscribers.size() + 63) / 64;
+                m_sets.assign(m_words, 0);
+                m_any.fill(0);
+                for (auto &codes : m_byCode)
+                {
+                    codes.clear();
+                }
+
+                for (uint32_t cls = 0; cls < classCount; ++cls)
+                {
+                    for (uint32_t type = 0; type < EV_CNT; ++type)
+                    {
+                        const size_t route = cls * EV_CNT + type;
+                        for (size_t i = 0; i < subscribers.size(); ++i)
+                        {
+                            if (wants(subscribers[i], cls, type) && subscribers[i].codes.empty())
+                            {
+                                m_any[route] = addBit(m_any[route], i);
+                            }
+                        }
+
+                        // codes someone picked get a set of their own: the any-code subscribers plus them
+                        auto &codes = m_byCode[route];
+                        for (size_t i = 0; i < subscribers.size(); ++i)
+                        {
+                            if (!wants(subscribers[i], cls, type))
+                            {
+                                continue;
+                            }
+                            for (auto code : subscribers[i].codes)
+                            {
+                                if (code >= codes.size())
+                                {
+                                    codes.resize(code + 1u, m_any[route]);
+                                }
+                                if (codes[code] == m_any[route])
+                                {
+                                    codes[code] = copySet(m_any[route]);
+                                }
+                                codes[code] = addBit(codes[code], i);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // Bitset of the subscribers for this event, nullptr when there are none.
+            const uint64_t *route(DeviceClass deviceClass, uint16_t type, uint16_t code) const
+            {
+                if (type >= EV_CNT)
+                {
+                    return nullptr;
+                }
+
+                const size_t route = static_cast<size_t>(deviceClass) * EV_CNT + type;
+                const auto &codes = m_byCode[route];
+                const uint32_t set = (code < codes.size()) ? codes[code] : m_any[route];
+                return (set != 0) ? &m_sets[set * m_words] : nullptr;
+            }
+
+            size_t words() const { return m_words; }
+
+        private:
+            static constexpr uint32_t classCount = static_cast<uint32_t>(DeviceClass::Count);
+
+            static bool wants(const Subscription &subscriber, uint32_t cls, uint32_t type)
+            {
+                return (subscriber.classes == 0 || (subscriber.classes & (1u << cls)) != 0)
+                    && (subscriber.types == 0 || (subscriber.types & (1u << type)) != 0);
+            }
+
+            uint32_t copySet(uint32_t set)
+            {
+                const uint32_t copy = static_cast<uint32_t>(m_sets.size() / m_words);
+                m_sets.resize(m_sets.size() + m_words);
+                std::copy_n(m_sets.begin() + set * m_words, m_words, m_sets.begin() + copy * m_words);
+                return copy;
+            }
+
+            // The shared empty set is copied before its first bit goes in.
+            uint32_t addBit(uint32_t set, size_t bit)
+            {
+                if (set == 0)
+                {
+                    set = copySet(0);
+                }
+                m_sets[set * m_words + bit / 64] |= 1ull << (bit % 64);
+                return set;
+            }
+
+            size_t m_words{ 0 };
+            std::vector<uint64_t> m_sets;
+            std::array<uint32_t, classCount * EV_CNT> m_any{};
+            std::array<std::vector<uint32_t>, classCount * EV_CNT> m_byCode;
+        };
+
+        static InputEvent toInputEvent(const InputDevice &device, const struct input_event &event)
         {
-            return;
+            InputEvent delivered;
+            delivered.node = device.node();
+            delivered.device = device.key();
+            delivered.deviceClass = device.deviceClass();
+            delivered.type = event.type;
+            delivered.code = event.code;
+            delivered.value = event.value;
+            delivered.time = static_cast<int64_t>(event.input_event_sec) * 1000000 + event.input_event_usec;
+            return delivered;
         }
 
-        ifs >> std::noskipws;
+        void dispatchEvent(const InputDevice &device, const struct input_event &event)
+        {
+            std::unique_lock<std::mutex> lock{ m_dispatchMtx };
+            const uint64_t *set = m_router.route(device.deviceClass(), event.type, event.code);
+            if (set == nullptr)
+            {
+                return;
+            }
 
-        std::string content{ std::istream_iterator<char>{ ifs }, std::istream_iterator<char>{} };
-        ifs.close();
+            const InputEvent delivered = toInputEvent(device, event);
+            for (size_t word = 0; word < m_router.words(); ++word)
+            {
+                for (uint64_t bits = set[word]; bits != 0; bits &= bits - 1)
+                {
+                    auto &subscriber = m_subscribers[word * 64 + static_cast<size_t>(__builtin_ctzll(bits))];
+                    if (*subscriber.active)
+                    {
+                        subscriber.handler(delivered);
+                    }
+                }
+            }
+        }
 
-        std::vector<std::string> deviceInfo;
+        enum class Drain : uint8_t
         {
-            const std::string sep{ "\n\n" };
+            Empty,      // read until EAGAIN
+            Pending,    // stopped at the per-visit quota with data left
+            Gone,       // EOF or a hard error
+            Flooding    // tripped the flood policy, see FloodState::reason
+        };
 
-            size_t begin = 0;
-            size_t end = 0;
-            std::string token;
+        // Events read from one device per visit, so a flooding device cannot starve the others.
+        static constexpr size_t drainQuota{ 512 };
 
-            while ((end = content.find(sep, begin)) != std::string::npos)
+        // Reads a ready device until EAGAIN or the quota, a batch of events per read().
+        Drain drainDevice(InputDevice &device, std::array<struct input_event, 64> &events, const FloodPolicy &policy, bool &firstEvent)
+        {
+            auto &flood = device.flood();
+            const auto now = std::chrono::steady_clock::now();
+            if (now - flood.windowStart >= std::chrono::seconds{ 1 })
             {
-                token = content.substr(begin, end - begin);
-                if (!token.empty())
+                flood.windowStart = now;
+                flood.windowEvents = 0;
+            }
+
+            size_t handled{ 0 };
+            while (handled < drainQuota)
+            {
+                const ssize_t n = ::read(device.fd(), events.data(), sizeof(events));
+                if (n > 0)
                 {
-                    begin += token.length();
-                    deviceInfo.push_back(std::move(token));
+                    const size_t count = static_cast<size_t>(n) / sizeof(struct input_event);
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        if (policy.maxIdenticalFrames != 0 && trackFrame(flood, events[i], policy.maxIdenticalFrames))
+                        {
+                            // the tripping frame is completed, the rest of the batch is discarded
+                            handleEvent(device, events[i], firstEvent);
+                            flood.reason = FloodReason::IdenticalFrames;
+                            return Drain::Flooding;
+                        }
+                        handleEvent(device, events[i], firstEvent);
+                    }
+                    handled += count;
+
+                    flood.windowEvents += static_cast<uint32_t>(count);
+                    if (policy.maxEventsPerSecond != 0 && flood.windowEvents > policy.maxEventsPerSecond)
+                    {
+                        flood.reason = FloodReason::Rate;
+                        return Drain::Flooding;
+                    }
+                    continue;
+                }
+
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? Drain::Empty : Drain::Gone;
+            }
+
+            return Drain::Pending;
+        }
+
+        // Hashes each frame's content and returns true once `limit` identical frames arrived in a row.
+        static bool trackFrame(FloodState &flood, const struct input_event &event, uint32_t limit)
+        {
+            if (event.type == EV_SYN && event.code == SYN_REPORT)
+            {
+                const bool identical = flood.frameCounts && !flood.frameRepeats && flood.frameHash == flood.lastFrameHash;
+                flood.identicalFrames = identical ? flood.identicalFrames + 1 : 0;
+                flood.lastFrameHash = flood.frameHash;
+                flood.frameHash = 14695981039346656037ull;
+                flood.frameRepeats = false;
+                flood.frameCounts = false;
+                return flood.identicalFrames >= limit;
+            }
+
+            if (event.type == EV_MSC && event.code == MSC_TIMESTAMP)
+            {
+                return false;
+            }
+
+            if (event.type != EV_REL)
+            {
+                flood.frameCounts = true;
+            }
+
+            if (event.type == EV_KEY && event.value == 2)
+            {
+                flood.frameRepeats = true;
+            }
+
+            const int32_t numbers[]{ event.type, event.code, event.value };
+            flood.frameHash = hashBytes(reinterpret_cast<const char *>(numbers), sizeof(numbers), flood.frameHash);
+            return false;
+        }
+
+        // Takes a flooding device out of the wait set; its fd stays open and what it queues meanwhile is
+        // dropped by the kernel, followed by SYN_DROPPED and a state resync once it is back.
+        void quarantineDevice(int epollFd, InputDevice &device, const FloodPolicy &policy)
+        {
+            auto &flood = device.flood();
+            const auto now = std::chrono::steady_clock::now();
+            if (now - flood.releasedAt > std::chrono::minutes{ 1 })
+            {
+                flood.strikes = 0;
+            }
+
+            const auto period = std::min<std::chrono::milliseconds>(policy.quarantine * (1LL << std::min(flood.strikes, 8u)),
+                                                                    std::chrono::minutes{ 5 });
+            ++flood.strikes;
+            flood.quarantinedUntil = now + period;
+            flood.windowEvents = 0;
+            flood.identicalFrames = 0;
+
+            ::epoll_ctl(epollFd, EPOLL_CTL_DEL, device.fd(), nullptr);
+            device.setWatched(false);
+            device.setBacklogged(false);
+
+            // the frames discarded now and while out of the wait set are a gap, reported the way evdev does;
+            // the tracked state is re-read at the first SYN_REPORT after the release
+            struct timespec wall{};
+            clock_gettime(CLOCK_REALTIME, &wall);
+            struct input_event dropped{};
+            dropped.input_event_sec = wall.tv_sec;
+            dropped.input_event_usec = wall.tv_nsec / 1000;
+            dropped.type = EV_SYN;
+            dropped.code = SYN_DROPPED;
+            bool firstEvent{ true };
+            handleEvent(device, dropped, firstEvent);
+
+            m_quarantines.fetch_add(1, std::memory_order_relaxed);
+            notifyQuarantine(device, true, period);
+        }
+
+        void releaseDevice(int epollFd, bool edgeTriggered, InputDevice &device)
+        {
+            auto &flood = device.flood();
+            flood.quarantinedUntil = std::chrono::steady_clock::time_point{};
+            flood.releasedAt = std::chrono::steady_clock::now();
+            flood.windowStart = flood.releasedAt;
+
+            struct epoll_event ev{};
+            ev.events = EPOLLIN | (edgeTriggered ? EPOLLET : 0u);
+            ev.data.u64 = static_cast<uint64_t>(device.fd());
+            device.setWatched(::epoll_ctl(epollFd, EPOLL_CTL_ADD, device.fd(), &ev) == 0);
+
+            m_releases.fetch_add(1, std::memory_order_relaxed);
+            notifyQuarantine(device, false, std::chrono::milliseconds{ 0 });
+        }
+
+        void notifyQuarantine(InputDevice &device, bool quarantined, std::chrono::milliseconds duration)
+        {
+            std::unique_lock<std::mutex> lock{ m_dispatchMtx };
+            if (!m_quarantineHandler)
+            {
+                return;
+            }
+
+            QuarantineEvent event;
+            event.device = device.info();
+            event.quarantined = quarantined;
+            event.reason = device.flood().reason;
+            event.duration = duration;
+            m_quarantineHandler(event);
+        }
+
+        // Tracks the device state and decides whether an event goes any further. With filters on, autorepeat
+        // and values equal to the tracked state are dropped, and so are frames left with only their SYN_REPORT.
+        bool acceptEvent(InputDevice &device, const struct input_event &event, uint32_t filters)
+        {
+            DeviceState *state = device.state();
+            if (state == nullptr)
+            {
+                return true;
+            }
+
+            if (event.type == EV_SYN)
+            {
+                if (event.code == SYN_DROPPED)
+                {
+                    state->dropping = true;
+                    return true;
+                }
+
+                if (event.code != SYN_REPORT)
+                {
+                    return true;
+                }
+
+                // the kernel's buffer overran: what came up to here is incomplete, ask for the real state
+                if (state->dropping)
+                {
+                    state->dropping = false;
+                    state->frameEmpty = true;
+                    state->sync(device.fd());
+                    return filters == 0;
+                }
+
+                const bool empty = state->frameEmpty;
+                state->frameEmpty = true;
+                if (empty && filters != 0)
+                {
+                    m_suppressedFrames.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                return true;
+            }
+
+            if (state->dropping)
+            {
+                return filters == 0;
+            }
+
+            bool keep{ true };
+            if (event.type == EV_KEY && event.code < KEY_CNT)
+            {
+                if (event.value == 2)
+                {
+                    keep = (filters & (1u << static_cast<uint32_t>(EventFilter::Autorepeat))) == 0;
+                    if (!keep)
+                    {
+                        m_suppressedRepeats.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                else
+                {
+                    auto &word = state->keys[event.code / DeviceState::wordBits];
+                    const unsigned long bit = 1UL << (event.code % DeviceState::wordBits);
+                    const bool down = (event.value != 0);
+
+                    if (((word & bit) != 0) == down && (filters & (1u << static_cast<uint32_t>(EventFilter::UnchangedValues))))
+                    {
+                        keep = false;
+                        m_suppressedUnchanged.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    word = down ? (word | bit) : (word & ~bit);
+                }
+            }
+            else if (event.type == EV_ABS && event.code < ABS_CNT)
+            {
+                // multitouch axes are per slot, the same value in another slot is not a repeat
+                const uint64_t bit = 1ull << event.code;
+                if (event.code < ABS_MT_SLOT && (state->absKnown & bit) && state->abs[event.code] == event.value
+                    && (filters & (1u << static_cast<uint32_t>(EventFilter::UnchangedValues))))
+                {
+                    keep = false;
+                    m_suppressedUnchanged.fetch_add(1, std::memory_order_relaxed);
+                }
+                state->abs[event.code] = event.value;
+                state->absKnown |= bit;
+            }
+
+            if (keep)
+            {
+                state->frameEmpty = false;
+            }
+            return keep;
+        }
+
+        void handleEvent(InputDevice &device, const struct input_event &event, bool &firstEvent)
+        {
+            if (!acceptEvent(device, event, m_eventFilters.load(std::memory_order_relaxed)))
+            {
+                return;
+            }
+
+            if (m_subscriberCount.load(std::memory_order_relaxed) > 0)
+            {
+                dispatchEvent(device, event);
+            }
+
+            if (m_streamConsumers.load(std::memory_order_acquire) > 0)
+            {
+                m_ring.load(std::memory_order_relaxed)->publish(toInputEvent(device, event));
+            }
+
+            if (event.type == EV_KEY || event.type == EV_REL || event.type == EV_ABS)
+            {
+                auto stamp = getCurrentTime();
+                m_classOperateTime[static_cast<size_t>(device.deviceClass())] = stamp;
+                if (m_idleTimerCount.load(std::memory_order_relaxed) > 0)
+                {
+                    noteIdleActivity(device.deviceClass());
+                }
+                if (auto group = device.group())
+                {
+                    group->events.fetch_add(1, std::memory_order_relaxed);
+                    group->lastOperateTime.store(stamp, std::memory_order_relaxed);
+                }
+                if (device.deviceClass() != DeviceClass::Sensor)
+                {
+                    stampActivity(stamp);
+                    if (!firstEvent)
+                    {
+                        firstEvent = true;
+                        recordFirstEvent();
+                    }
+                }
+            }
+        }
+
+        void recordHotplugStorm(size_t size, std::chrono::steady_clock::duration elapsed)
+        {
+            const auto reconcile = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            ++m_hotplugStats.storms;
+            m_hotplugStats.notifications += size;
+            m_hotplugStats.lastStormSize = size;
+            m_hotplugStats.largestStorm = std::max<uint64_t>(m_hotplugStats.largestStorm, size);
+            m_hotplugStats.lastReconcileTime = reconcile;
+            m_hotplugStats.maxReconcileTime = std::max(m_hotplugStats.maxReconcileTime, reconcile);
+        }
+
+        // Attaches every device to the state of its group and publishes the snapshots returned by devices()
+        // and skippedDevices().
+        void publishDevices(std::vector<InputDevice> &devices, std::vector<DeviceInfo> skipped = {})
+        {
+            std::vector<DeviceInfo> infos;
+            std::unordered_map<uint64_t, std::shared_ptr<GroupState>> groups;
+
+            infos.reserve(devices.size());
+            for (auto &device : devices)
+            {
+                infos.push_back(device.info());
+            }
+
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            for (auto &device : devices)
+            {
+                auto &group = groups[device.info().group];
+                if (!group)
+                {
+                    auto it = m_groupStates.find(device.info().group);
+                    group = (it != m_groupStates.end()) ? it->second : std::make_shared<GroupState>();
+                }
+                device.setGroup(group);
+            }
+
+            m_deviceInfos.swap(infos);
+            m_groupStates.swap(groups);
+            m_skippedInfos.swap(skipped);
+        }
+
+        static void closeInputDevices(std::vector<InputDevice> &devices)
+        {
+            for (auto &device : devices)
+            {
+                device.close();
+            }
+        }
+
+        // Moves devices handed over by attachDevice() into the reader's list.
+        bool adoptAttached(std::vector<InputDevice> &devices)
+        {
+            std::vector<std::pair<int, DeviceInfo>> queue;
+            {
+                std::unique_lock<std::mutex> lock{ m_configMtx };
+                queue.swap(m_attachQueue);
+            }
+
+            for (auto &entry : queue)
+            {
+                if (entry.second.group == 0)
+                {
+                    entry.second.group = groupKey(entry.second);
+                }
+
+                // the reader drains until EAGAIN, whatever mode the fd was opened in
+                ::fcntl(entry.first, F_SETFL, ::fcntl(entry.first, F_GETFL) | O_NONBLOCK);
+                ::fcntl(entry.first, F_SETFD, FD_CLOEXEC);
+
+                auto state = std::make_unique<DeviceState>();
+                state->sync(entry.first);
+
+                InputDevice device{ std::move(entry.second) };
+                device.adopt(entry.first, Bitmap{}, std::move(state));
+                device.setExternal(true);
+                devices.push_back(std::move(device));
+            }
+
+            return !queue.empty();
+        }
+
+        // Registers devices opened since the last call, unless paused, and rebuilds the fd -> device index.
+        static void watchDevices(int epollFd, bool edgeTriggered, bool paused, std::vector<InputDevice> &devices,
+                                 std::vector<InputDevice *> &byFd)
+        {
+            byFd.clear();
+            for (auto &device : devices)
+            {
+                const int fd = device.fd();
+                if (fd == -1)
+                {
+                    continue;
+                }
+
+                if (!paused && !device.watched() && !device.quarantined())
+                {
+                    struct epoll_event ev{};
+                    ev.events = EPOLLIN | (edgeTriggered ? EPOLLET : 0u);
+                    ev.data.u64 = static_cast<uint64_t>(fd);
+                    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+                    {
+                        continue;
+                    }
+                    device.setWatched(true);
+                }
+
+                if (static_cast<size_t>(fd) >= byFd.size())
+                {
+                    byFd.resize(static_cast<size_t>(fd) + 1, nullptr);
                 }
-                begin += sep.length();
+                byFd[static_cast<size_t>(fd)] = &device;
             }
         }
 
-        for (auto &info : deviceInfo)
+        void run(std::promise<bool> quitPromise)
         {
-            std::vector<std::string> props;
+            // epoll data of the non-device fds, above any fd number
+            static constexpr uint64_t hotplugTag = 1ull << 32;
+            static constexpr uint64_t probeTag = 2ull << 32;
+            static constexpr uint64_t wakeTag = 3ull << 32;
+            static constexpr uint64_t idleTag = 4ull << 32;
+
+            int ret{ -1 };
+            bool isListening{ false };
+
+            std::array<struct input_event, 64> events;
+            std::array<struct epoll_event, 64> ready;
+
+            std::vector<InputDevice> devices;
+            std::vector<InputDevice *> byFd;
+            std::vector<int> backlog;       // edge-triggered: fds that still have data after their visit
+            std::vector<int> revisit;
+            std::vector<int> quarantined;
+            FloodPolicy flood;
+            bool paused{ false };
+            const bool edgeTriggered = m_edgeTriggered;
+            ScanOptions options;
+            DiscoveryState discovery;
+            HotplugMonitor hotplug;
+            bool firstEvent{ false };
+            int watchedHotplugFd{ -1 };
+
+            const int epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+            auto watchFd = [epollFd](int fd, uint64_t tag)
             {
-                std::stringstream ss{ info };
-                std::string token;
+                struct epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.u64 = tag;
+                return ::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+            };
+            watchFd(discovery.probes.notifyFd(), probeTag);
+            if (m_wakeFd != -1)
+            {
+                watchFd(m_wakeFd, wakeTag);
+            }
+            if (m_idleTimerFd != -1)
+            {
+                watchFd(m_idleTimerFd, idleTag);
+            }
 
-                while (std::getline(ss, token, '\n'))
+            {
+                std::unique_lock<std::mutex> lock{ m_configMtx };
+                options.cachePath = m_cachePath;
+            }
+            if (!options.cachePath.empty())
+            {
+                // a table that comes out the same is not written back
+                if (DeviceCache::load(options.cachePath, discovery.warmRuleDigest, discovery.warm))
                 {
-                    if (!token.empty())
-                    {
-                        props.push_back(std::move(token));
-                    }
+                    discovery.cacheHash = DeviceCache::digest(discovery.warmRuleDigest, discovery.warm);
                 }
             }
 
-            if (props.empty())
+            auto sleepOffset = suspendOffset();
+            while (m_isRunning && epollFd != -1)
             {
-                continue;
-            }
-
-            std::string id;
-            std::string name;
-            std::string handler;
-            bool isInputDevice{ false };
+                if (m_rescanRequested.exchange(false))
+                {
+                    discovery.dirty = true;
+                }
+                {
+                    std::unique_lock<std::mutex> lock{ m_configMtx };
+                    options.matcher = m_matcher;
+                }
+                options.primaryNodesOnly = m_primaryNodesOnly;
+                options.source = m_discoverySource;
+                options.probeTimeout = probeTimeout();
+                options.fdBudget = m_fdBudget;
+                options.demandedClasses = m_demandedClasses;
+                options.includeSensors = m_sensorsEnabled
+                                         || (options.demandedClasses & (1u << static_cast<uint32_t>(DeviceClass::Sensor))) != 0;
+                hotplug.watch();
+                if (hotplug.fd() != -1 && watchedHotplugFd == -1 && watchFd(hotplug.fd(), hotplugTag))
+                {
+                    watchedHotplugFd = hotplug.fd();
+                }
 
-            for (auto &prop : props)
-            {
-                if (prop.find(idPrefix) == 0)
+                const auto reconcileBegin = std::chrono::steady_clock::now();
+                const bool rescanned = openInputDevices(devices, options, discovery);
+                if (rescanned)
                 {
-                    id = prop.substr(idPrefix.length());
+                    ++m_fullRescans;
                 }
-                else if (prop.find(namePrefix) == 0)
+                else
                 {
-                    name = prop.substr(namePrefix.length());
-                    if (!name.empty())
+                    ++m_skippedRescans;
+                }
+
+                if (adoptAttached(devices) || rescanned)
+                {
+                    publishDevices(devices, discovery.skipped);
+                    watchDevices(epollFd, edgeTriggered, paused, devices, byFd);
+
+                    if (!m_isReady)
                     {
-                        name.erase(0, name.find_first_not_of('\"'));
-                        name.erase(name.find_last_not_of('\"') + 1);
+                        StartupMetrics metrics;
+                        metrics.discovery = std::chrono::duration_cast<std::chrono::microseconds>(discovery.discoveryTime);
+                        metrics.parse = std::chrono::duration_cast<std::chrono::microseconds>(discovery.parseTime);
+                        metrics.open = std::chrono::duration_cast<std::chrono::microseconds>(discovery.openTime);
+                        metrics.devices = devices.size();
+                        markReady(metrics);
                     }
                 }
-                else if (prop.find(handlerPrefix) == 0)
+
+                if (hotplug.pending() > 0)
                 {
-                    std::stringstream ss{ prop.substr(handlerPrefix.length()) };
-                    std::string token;
+                    recordHotplugStorm(hotplug.pending(), std::chrono::steady_clock::now() - reconcileBegin);
+                    hotplug.reset();
+                }
 
-                    while (std::getline(ss, token, ' '))
+                isListening = true;
+                while (m_isRunning && isListening && !m_rescanRequested && !discovery.dirty)
+                {
+                    const auto offset = suspendOffset();
+                    if (offset - sleepOffset > std::chrono::seconds{ 1 })
                     {
-                        if (!token.empty() && token.find("event") == 0)
+                        resumeDevices(devices, byFd, discovery, offset - sleepOffset);
+                        sleepOffset = offset;
+                        continue;
+                    }
+                    sleepOffset = offset;
+
+                    if (m_paused != paused)
+                    {
+                        paused = m_paused;
+                        if (paused)
                         {
-                            handler = devicePath + token;
-                            break;
+                            unwatchDevices(epollFd, devices);
+                            backlog.clear();
+                        }
+                        else
+                        {
+                            flushDevices(devices, byFd, discovery);
+                            watchDevices(epollFd, edgeTriggered, paused, devices, byFd);
                         }
                     }
-                }
-                else if (prop.find(eventPrefix) == 0)
-                {
-                    int i = 0, j = 0;
-                    auto ev = prop.substr(eventPrefix.length());
 
-                    for (auto it = ev.rbegin(); it != ev.rend(); ++it)
+                    int timeoutMs = backlog.empty() ? 5000 : 0;
+                    auto wakeAt = discovery.nextRetry();
+                    flood = floodPolicy();
+
+                    // let devices whose quarantine ran out back in, forget ones that were closed meanwhile
+                    const auto quarantineNow = std::chrono::steady_clock::now();
+                    for (auto it = quarantined.begin(); it != quarantined.end() && !paused; )
+                    {
+                        const size_t fd = static_cast<size_t>(*it);
+                        InputDevice *device = (fd < byFd.size()) ? byFd[fd] : nullptr;
+                        if (device == nullptr || !device->quarantined())
+                        {
+                            // closed while quarantined, which ends the quarantine too
+                            m_releases.fetch_add(1, std::memory_order_relaxed);
+                            it = quarantined.erase(it);
+                        }
+                        else if (quarantineNow >= device->flood().quarantinedUntil)
+                        {
+                            releaseDevice(epollFd, edgeTriggered, *device);
+                            it = quarantined.erase(it);
+                        }
+                        else
+                        {
+                            wakeAt = std::min(wakeAt, device->flood().quarantinedUntil);
+                            ++it;
+                        }
+                    }
+                    if (hotplug.pending() > 0)
+                    {
+                        wakeAt = std::min(wakeAt, hotplug.deadline());
+                    }
+
+                    if (wakeAt != (std::chrono::steady_clock::time_point::max)())
+                    {
+                        auto wait = std::chrono::ceil<std::chrono::milliseconds>(wakeAt - std::chrono::steady_clock::now());
+                        timeoutMs = static_cast<int>(std::min<int64_t>(std::max<int64_t>(wait.count(), 0), timeoutMs));
+                    }
+
+                    ret = ::epoll_wait(epollFd, ready.data(), static_cast<int>(ready.size()), timeoutMs);
+                    if (ret < 0)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        break;
+                    }
+
+                    if (ret == 0 && backlog.empty() && hotplug.fd() == -1)
+                    {
+                        // no hotplug watch yet, poll for the device directory and new nodes
+                        break;
+                    }
+
+                    // a quota hit leaves data behind; level-triggered epoll reports it again, edge-triggered
+                    // mode queues the device for another visit after everything else ready got one
+                    auto visit = [&](InputDevice &device, size_t fd)
+                    {
+                        switch (drainDevice(device, events, flood, firstEvent))
+                        {
+                        case Drain::Flooding:
+                            quarantineDevice(epollFd, device, flood);
+                            quarantined.push_back(static_cast<int>(fd));
+                            break;
+                        case Drain::Gone:
+                            byFd[fd] = nullptr;
+                            device.close();
+                            discovery.dirty = true;
+                            isListening = false;
+                            break;
+                        case Drain::Pending:
+                            if (edgeTriggered && !device.backlogged())
+                            {
+                                device.setBacklogged(true);
+                                backlog.push_back(static_cast<int>(fd));
+                            }
+                            break;
+                        case Drain::Empty:
+                            break;
+                        }
+                    };
+
+                    // every ready device is visited even if one went away; an edge is not reported twice
+                    for (int i = 0; i < ret; ++i)
                     {
-                        auto n = std::stoi(std::string{ *it }, nullptr, 16);
-                        for (size_t k = 0; k < bits.size(); ++k)
+                        const uint64_t tag = ready[i].data.u64;
+                        if (tag == wakeTag)
                         {
-                            if (n & bits[k])
+                            uint64_t value;
+                            while (::read(m_wakeFd, &value, sizeof(value)) > 0)
                             {
-                                if ((i + j) == EV_KEY || (i + j) == EV_REL || (i + j) == EV_ABS)
-                                {
-                                    isInputDevice = true;
-                                    break;
-                                }
                             }
+                            if (m_idleRecheck.exchange(false))
+                            {
+                                rearmDeferredIdleTimers();
+                            }
+                            continue;
+                        }
+
+                        if (tag == idleTag)
+                        {
+                            expireIdleTimers();
+                            continue;
+                        }
+
+                        if (tag == probeTag)
+                        {
+                            // a slow probe finished, adopt it now
+                            discovery.probes.clearNotify();
+                            discovery.dirty = discovery.dirty || !discovery.probing.empty();
+                            continue;
+                        }
 
-                            if (++i > 9)
+                        if (tag == hotplugTag)
+                        {
+                            hotplug.drain(hotplugWindow());
+                            for (auto &node : hotplug.takeChanged())
                             {
-                                i = 0;
-                                j += 10;
+                                discovery.clearFailure(node);
                             }
+                            continue;
+                        }
+
+                        const size_t fd = static_cast<size_t>(tag);
+                        InputDevice *device = (fd < byFd.size()) ? byFd[fd] : nullptr;
+                        if (device == nullptr)
+                        {
+                            continue;
+                        }
+
+                        if (!device->backlogged())
+                        {
+                            visit(*device, fd);
+                        }
+                    }
+
+                    revisit.swap(backlog);
+                    for (int fd : revisit)
+                    {
+                        InputDevice *device = (static_cast<size_t>(fd) < byFd.size()) ? byFd[static_cast<size_t>(fd)] : nullptr;
+                        if (device != nullptr && device->backlogged())
+                        {
+                            device->setBacklogged(false);
+                            visit(*device, static_cast<size_t>(fd));
                         }
                     }
+                    revisit.clear();
+
+                    if (m_streamConsumers.load(std::memory_order_acquire) > 0)
+                    {
+                        notifyStream();
+                    }
+
+                    if (hotplug.expired(std::chrono::steady_clock::now())
+                        || std::chrono::steady_clock::now() >= discovery.nextRetry())
+                    {
+                        discovery.dirty = true;
+                        break;
+                    }
                 }
             }
 
-            if (isInputDevice && !handler.empty())
+            m_releases.fetch_add(quarantined.size(), std::memory_order_relaxed);
+            closeInputDevices(devices);
+            devices.clear();
+            publishDevices(devices);
+            adoptAttached(devices);
+            closeInputDevices(devices);
+            if (epollFd != -1)
             {
-                devices.emplace_back(id, name, handler);
+                ::close(epollFd);
             }
-        }
-    }
 
-    static void openInputDevices(fd_set &allfds, std::vector<InputDevice> &devices)
-    {
-        FD_ZERO(&allfds);
-
-        std::vector<InputDevice> allDevices;
-        std::vector<InputDevice> openedDevices;
+            m_isRunning = false;
+            quitPromise.set_value(m_isRunning);
+        }
 
-        availableInputDevices(allDevices);
-        for (auto it = allDevices.begin(); it != allDevices.end(); ++it)
+        static void unwatchDevices(int epollFd, std::vector<InputDevice> &devices)
         {
-            bool isOpened{ false };
-
-            auto dIt = std::find_if(devices.begin(), devices.end(), [&it](const InputDevice &dev){ return *it == dev; });
-            if (dIt != devices.end())
+            for (auto &device : devices)
             {
-                isOpened = dIt->isOpened();
-                if (isOpened)
+                if (device.watched())
                 {
-                    FD_SET(*dIt, &allfds);
-                    openedDevices.push_back(std::move(*dIt));
+                    ::epoll_ctl(epollFd, EPOLL_CTL_DEL, device.fd(), nullptr);
+                    device.setWatched(false);
                 }
+                device.setBacklogged(false);
             }
+        }
 
-            if (!isOpened)
+        // Drops what devices queued while paused and re-reads their state in its place.
+        static void flushDevices(std::vector<InputDevice> &devices, std::vector<InputDevice *> &byFd, DiscoveryState &discovery)
+        {
+            std::array<struct input_event, 64> events;
+            for (auto &device : devices)
             {
-                if (it->open())
+                const int fd = device.fd();
+                if (fd == -1 || device.quarantined())
+                {
+                    continue;
+                }
+
+                ssize_t n;
+                while ((n = ::read(fd, events.data(), sizeof(events))) > 0)
+                {
+                }
+
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                    byFd[static_cast<size_t>(fd)] = nullptr;
+                    device.close();
+                    discovery.dirty = true;
+                    continue;
+                }
+
+                if (auto state = device.state())
                 {
-                    FD_SET(*it, &allfds);
-                    openedDevices.push_back(std::move(*it));
+                    state->sync(fd);
+                    state->dropping = false;
+                    state->frameEmpty = true;
                 }
             }
         }
 
-        std::sort(openedDevices.begin(), openedDevices.end(), std::less<InputDevice>{});
-        devices.swap(openedDevices);
-    }
-
-    static void closeInputDevices(std::vector<InputDevice> &devices)
-    {
-        for (auto &device : devices)
+        // CLOCK_BOOTTIME keeps counting while the system is suspended and CLOCK_MONOTONIC does not, so
+        // this offset grows by exactly the time spent suspended.
+        static std::chrono::nanoseconds suspendOffset()
         {
-            device.close();
+            struct timespec boot, mono;
+            clock_gettime(CLOCK_BOOTTIME, &boot);
+            clock_gettime(CLOCK_MONOTONIC, &mono);
+            return std::chrono::seconds{ boot.tv_sec - mono.tv_sec } + std::chrono::nanoseconds{ boot.tv_nsec - mono.tv_nsec };
         }
-    }
 
-    void run(std::promise<bool> quitPromise)
-    {
-        int ret{ -1 };
-        bool isListening{ false };
-        ssize_t n;
-        fd_set rfds, allfds;
-
-        struct timeval tv;
-        struct input_event event;
-
-        std::vector<InputDevice> devices;
-
-        auto now = getCurrentTime();
-        auto last = now;
-        while (m_isRunning)
+        // After a resume only nodes whose device went away are closed and left to the rescan to reopen;
+        // the others keep their fd and just re-read key and axis state, which may have changed unseen.
+        void resumeDevices(std::vector<InputDevice> &devices, std::vector<InputDevice *> &byFd, DiscoveryState &discovery,
+                           std::chrono::nanoseconds suspended)
         {
-            openInputDevices(allfds, devices);
-            if (devices.empty())
-            {
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-                continue;
-            }
-
-            isListening = true;
-            last = getCurrentTime();
-            while (m_isRunning && isListening)
+            uint64_t reopened{ 0 };
+            for (auto &device : devices)
             {
-                now = getCurrentTime();
-                if (last - now > 5)
+                const int fd = device.fd();
+                if (fd == -1)
                 {
-                    break;
+                    continue;
                 }
-                last = now;
 
-                rfds = allfds;
-                tv.tv_sec = 5;
-                tv.tv_usec = 0;
-
-                ret = ::select(devices.back() + 1, &rfds, nullptr, nullptr, &tv);
-                if (ret < 0)
+                int version{ 0 };
+                if (::ioctl(fd, EVIOCGVERSION, &version) < 0 && errno == ENODEV)
                 {
-                    break;
+                    byFd[static_cast<size_t>(fd)] = nullptr;
+                    device.close();
+                    discovery.dirty = true;
+                    ++reopened;
+                    continue;
                 }
-                else if (ret == 0)
+
+                if (auto state = device.state())
                 {
-                    continue;
+                    state->sync(fd);
+                    state->dropping = false;
+                    state->frameEmpty = true;
                 }
-                else
+            }
+
+            std::unique_lock<std::mutex> lock{ m_configMtx };
+            ++m_suspendStats.resumes;
+            m_suspendStats.reopened += reopened;
+            m_suspendStats.lastSuspend = std::chrono::duration_cast<std::chrono::milliseconds>(suspended);
+        }
+
+        time_t getCurrentTime() const
+        {
+            struct timespec res;
+            clock_gettime(CLOCK_MONOTONIC, &res);
+            return res.tv_sec;
+
+            // return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+#elif defined(_WIN32)
+        void run(std::promise<bool> quitPromise)
+        {
+            LASTINPUTINFO plii;
+
+            markReady(StartupMetrics{});
+
+            while (m_isRunning)
+            {
+                plii.cbSize = sizeof(LASTINPUTINFO);
+                if (!m_paused && ::GetLastInputInfo(&plii))
                 {
-                    for (auto it = devices.begin(); it != devices.end(); ++it)
+                    time_t now = plii.dwTime / 1000;
+                    if (now != m_lastOperateTime)
                     {
-                        if (FD_ISSET(*it, &rfds))
-                        {
-                            n = ::read(*it, &event, sizeof(event));
-                            if (n == sizeof(event))
-                            {
-                                if (event.type == EV_KEY || event.type == EV_REL || event.type == EV_ABS)
-                                {
-                                    m_lastOperateTime = getCurrentTime();
-                                }
-                            }
-                            else if (n <= 0)
-                            {
-                                FD_CLR(*it, &allfds);
-                                it->close();
-                                isListening = false;
-                                break;
-                            }
-                        }
+                        stampActivity(now);
                     }
                 }
 
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                std::this_thread::sleep_for(std::chrono::seconds(1));
             }
+
+            m_isRunning = false;
+            quitPromise.set_value(m_isRunning);
         }
 
-        closeInputDevices(devices);
+#endif
 
-        m_isRunning = false;
-        quitPromise.set_value(m_isRunning);
-    }
+        void markReady(StartupMetrics metrics)
+        {
+            {
+                std::unique_lock<std::mutex> lock{ m_readyMtx };
+                metrics.ready = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_startedAt);
+                metrics.firstEvent = m_startupMetrics.firstEvent;
+                m_startupMetrics = metrics;
+                m_isReady = true;
+            }
+            m_readyCv.notify_all();
+        }
 
-    time_t getCurrentTime() const
-    {
-        struct timespec res;
-        clock_gettime(CLOCK_MONOTONIC, &res);
-        return res.tv_sec;
+        void recordFirstEvent()
+        {
+            std::unique_lock<std::mutex> lock{ m_readyMtx };
+            m_startupMetrics.firstEvent = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_startedAt);
+        }
 
-        // return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
-    }
+        void stampActivity(time_t now)
+        {
+            m_lastOperateTime = now;
+            m_activitySeq.fetch_add(1);
+            if (m_activityWaiters.load() > 0)
+            {
+                m_wakeWord.fetch_add(1);
+                wakeWordWaiters();
+            }
+        }
 
+        // std::atomic::wait has no timed variant, so the same kernel primitive it is built on is used directly.
+        // The sequence is 64-bit, so waiters sleep on a separate 32-bit word bumped by stamps and view stops.
+        void waitOnWord(uint32_t expected, std::chrono::milliseconds timeout)
+        {
+            static_assert(sizeof(m_wakeWord) == sizeof(uint32_t), "wake word must be a plain 32-bit word");
+#if defined(__linux__)
+            struct timespec ts;
+            struct timespec *pts{ nullptr };
+            if (timeout != (std::chrono::milliseconds::max)())
+            {
+                ts.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+                ts.tv_nsec = static_cast<long>((timeout.count() % 1000) * 1000000);
+                pts = &ts;
+            }
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&m_wakeWord), FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
 #elif defined(_WIN32)
-	void run(std::promise<bool> quitPromise)
-	{
-		LASTINPUTINFO plii;
-
-		while (m_isRunning)
-		{
-			plii.cbSize = sizeof(LASTINPUTINFO);
-            if (::GetLastInputInfo(&plii))
-			{
-                m_lastOperateTime = plii.dwTime / 1000;
-			}
+            DWORD ms = (timeout == (std::chrono::milliseconds::max)()) ? INFINITE
+                     : static_cast<DWORD>(std::min<long long>(timeout.count(), INFINITE - 1));
+            ::WaitOnAddress(&m_wakeWord, &expected, sizeof(expected), ms);
+#else
+            m_wakeWord.wait(expected);
+#endif
+        }
 
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		}
+        void wakeWordWaiters()
+        {
+#if defined(__linux__)
+            ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&m_wakeWord), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#elif defined(_WIN32)
+            ::WakeByAddressAll(&m_wakeWord);
+#else
+            m_wakeWord.notify_all();
+#endif
+        }
 
-		m_isRunning = false;
-		quitPromise.set_value(m_isRunning);
-	}
+        // The reader applies the change itself; called with m_viewMtx held.
+        void updatePaused()
+        {
+            const bool paused = (m_views > 0 && m_pausedViews == m_views);
+            if (m_paused.exchange(paused) != paused)
+            {
+                wakeReader();
+            }
+        }
 
+        void wakeReader()
+        {
+#if defined(__linux__)
+            if (m_wakeFd != -1)
+            {
+                const uint64_t value{ 1 };
+                [[maybe_unused]] auto n = ::write(m_wakeFd, &value, sizeof(value));
+            }
 #endif
+        }
 
-	bool listen()
-	{
-		if (m_isRunning)
-		{
-			return true;
-		}
+        bool listen()
+        {
+            if (m_isRunning)
+            {
+                return true;
+            }
 
-		m_isRunning = true;
+            m_isRunning = true;
+            {
+                std::unique_lock<std::mutex> lock{ m_readyMtx };
+                m_isReady = false;
+                m_startedAt = std::chrono::steady_clock::now();
+                m_startupMetrics = StartupMetrics{};
+            }
 
-		std::promise<bool> quitPromise;
-		m_future = quitPromise.get_future();
+            std::promise<bool> quitPromise;
+            m_future = quitPromise.get_future();
 
-		std::thread thd{ &InputDeviceListener::run, this, std::move(quitPromise) };
-		thd.detach();
+            std::thread thd{ &Core::run, this, std::move(quitPromise) };
+            thd.detach();
 
-		return true;
-	}
+            return true;
+        }
 
-	void shutdown()
-	{
-		if (m_isRunning)
-		{
-			m_isRunning = false;
-			m_future.get();
-		}
-	}
+        void shutdown()
+        {
+            if (m_isRunning)
+            {
+                m_isRunning = false;
+                wakeReader();
+                releaseWaiters();
+                {
+                    std::unique_lock<std::mutex> lock{ m_readyMtx };
+                }
+                m_readyCv.notify_all();
+                m_future.get();
+                m_isReady = false;
+            }
+        }
 
-private:
-	std::mutex m_mtx;
-	std::future<bool> m_future;
+    private:
+        std::mutex m_viewMtx;
+        uint32_t m_views{ 0 };
+        uint32_t m_pausedViews{ 0 };
+        std::atomic_bool m_paused{ false };
+        std::future<bool> m_future;
+        std::atomic_bool m_isRunning{ false };
+        std::atomic_bool m_isReady{ false };
+        mutable std::mutex m_readyMtx;
+        mutable std::condition_variable m_readyCv;
+        std::chrono::steady_clock::time_point m_startedAt;
+        StartupMetrics m_startupMetrics;
+        std::atomic<time_t> m_lastOperateTime{ 0 };
+        std::array<std::atomic<time_t>, static_cast<size_t>(DeviceClass::Count)> m_classOperateTime{};
+        std::atomic_bool m_sensorsEnabled{ false };
+        std::atomic_bool m_rescanRequested{ false };
+        std::atomic<uint64_t> m_activitySeq{ 0 };
+        std::atomic<uint32_t> m_wakeWord{ 0 };
+        std::atomic<uint32_t> m_activityWaiters{ 0 };
+#if defined(__linux__)
+        mutable std::mutex m_configMtx;
+        std::shared_ptr<const DeviceMatcher> m_matcher{ std::make_shared<const DeviceMatcher>(std::vector<DeviceRule>{}) };
+        std::vector<DeviceInfo> m_deviceInfos;
+        std::string m_cachePath;
+        std::unordered_map<uint64_t, std::shared_ptr<GroupState>> m_groupStates;
+        HotplugStats m_hotplugStats;
+        SuspendStats m_suspendStats;
+        std::atomic<int64_t> m_hotplugWindowMs{ 50 };
+        std::atomic<int64_t> m_probeTimeoutMs{ 250 };
+        std::atomic<size_t> m_fdBudget{ 0 };
+        std::vector<DeviceInfo> m_skippedInfos;
+        std::vector<std::pair<int, DeviceInfo>> m_attachQueue;
+        int m_wakeFd{ -1 };
+        std::atomic_bool m_edgeTriggered{ false };
+        std::atomic<uint32_t> m_eventFilters{ 0 };
+        std::atomic<uint64_t> m_suppressedRepeats{ 0 };
+        std::atomic<uint64_t> m_suppressedUnchanged{ 0 };
+        std::atomic<uint64_t> m_suppressedFrames{ 0 };
+        std::atomic<uint32_t> m_floodRate{ 0 };
+        std::atomic<uint32_t> m_floodFrames{ 0 };
+        std::atomic<int64_t> m_quarantineMs{ 10000 };
+        std::atomic<uint64_t> m_quarantines{ 0 };
+        std::atomic<uint64_t> m_releases{ 0 };
+        QuarantineHandler m_quarantineHandler;
+        std::atomic_bool m_primaryNodesOnly{ false };
+        std::atomic<DiscoverySource> m_discoverySource{ DiscoverySource::ProcFs };
+        std::atomic<uint64_t> m_fullRescans{ 0 };
+        std::atomic<uint64_t> m_skippedRescans{ 0 };
+        std::mutex m_dispatchMtx;
+        std::vector<Subscription> m_subscribers;
+        EventRouter m_router;
+        std::atomic<uint32_t> m_subscriberCount{ 0 };
+        int m_nextSubscription{ 1 };
+        std::atomic<uint32_t> m_demandedClasses{ 0 };
+        std::mutex m_demandMtx;
+        std::vector<Demand> m_demands;
+        std::mutex m_idleMtx;
+        TimingWheel m_idleWheel{ idleClockMs() };
+        std::vector<IdleTimer> m_idleSlots;             // indexed by wheel timer number
+        std::vector<uint32_t> m_freeIdleSlots;
+        std::vector<uint32_t> m_idleNow;                // slots reported idle, waiting for input
+        std::vector<uint32_t> m_idleExpired;
+        std::vector<uint32_t> m_idleDeferred;           // slots that came due while their listener was inactive
+        std::atomic_bool m_idleRecheck{ false };
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(DeviceClass::Count)> m_idleActivity{};
+        std::array<std::atomic<uint32_t>, static_cast<size_t>(DeviceClass::Count)> m_idleWaiting{};
+        std::atomic<uint32_t> m_idleTimerCount{ 0 };
+        int m_nextIdleTimer{ 1 };
+        int m_idleTimerFd{ -1 };
+        uint64_t m_idleFdTick{ TimingWheel::never };
+        mutable std::mutex m_streamMtx;
+        size_t m_streamCapacity{ 4096 };
+        std::atomic<BroadcastRing *> m_ring{ nullptr };    // created by the first openStream(), owned here
+        std::atomic<uint32_t> m_streamConsumers{ 0 };
+        uint64_t m_streamNotified{ 0 };
+#endif
+    };
+
+    std::mutex m_mtx;
     std::atomic_bool m_isRunning{ false };
-    std::atomic<time_t> m_lastOperateTime{ 0 };
+    std::atomic_bool m_isPaused{ false };
+    std::atomic_bool m_isListening{ false };   // started and not paused
+    std::shared_ptr<Core> m_core;
+#if defined(__linux__)
+    std::vector<int> m_subscriptions;
+    std::vector<int> m_idleTimers;
+    std::vector<int> m_streams;
+#endif
 };
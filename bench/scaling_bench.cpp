@@ -0,0 +1,177 @@
+// Scaling benchmark for the Linux reader: attaches 1..4096 pipe-backed fake devices whose fds are all
+// above 1024, then reports wakeup latency of an idle listener and CPU time per event under load, in
+// level-triggered and edge-triggered mode.
+//
+//   g++ -std=c++17 -O2 -pthread bench/scaling_bench.cpp -o scaling_bench && ./scaling_bench
+
+#include "../InputDeviceListener.h"
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    constexpr int firstFd{ 1100 };
+    constexpr int latencySamples{ 200 };
+    constexpr int loadEvents{ 20000 };
+
+    struct FakeDevice
+    {
+        int readFd{ -1 };
+        int writeFd{ -1 };
+    };
+
+    double cpuSeconds()
+    {
+        struct rusage usage;
+        ::getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    bool raiseFdLimit(size_t needed)
+    {
+        struct rlimit limit;
+        if (::getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        {
+            return false;
+        }
+
+        if (limit.rlim_cur < needed)
+        {
+            limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, needed);
+            ::setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        return limit.rlim_cur >= needed;
+    }
+
+    bool writeKey(int fd, int value)
+    {
+        struct input_event event{};
+        event.type = EV_KEY;
+        event.code = KEY_A;
+        event.value = value;
+        return ::write(fd, &event, sizeof(event)) == sizeof(event);
+    }
+
+    bool run(size_t count, bool edgeTriggered)
+    {
+        InputDeviceListener listener;
+        listener.setEdgeTriggered(edgeTriggered);
+
+        // keep real devices out of the measurement
+        listener.setDeviceRules({ InputDeviceListener::DeviceRule{} });
+        listener.setFdBudget(SIZE_MAX);
+
+        std::vector<FakeDevice> devices(count);
+        int maxFd{ -1 };
+        for (size_t i = 0; i < count; ++i)
+        {
+            int fds[2];
+            if (::pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0)
+            {
+                std::perror("pipe2");
+                return false;
+            }
+
+            // every device fd lands above FD_SETSIZE
+            devices[i].readFd = ::fcntl(fds[0], F_DUPFD_CLOEXEC, firstFd);
+            devices[i].writeFd = fds[1];
+            ::close(fds[0]);
+            maxFd = std::max(maxFd, devices[i].readFd);
+
+            InputDeviceListener::DeviceInfo info;
+            info.key = InputDeviceListener::makeDeviceKey(BUS_VIRTUAL, 0x1234, static_cast<uint16_t>(i));
+            info.name = "bench device " + std::to_string(i);
+            info.deviceClass = InputDeviceListener::DeviceClass::Keyboard;
+            listener.attachDevice(devices[i].readFd, std::move(info));
+        }
+
+        listener.start(std::chrono::seconds(5));
+        while (listener.devices().size() < count)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // wakeup latency: one event at a time into an idle listener
+        std::vector<double> latencies;
+        latencies.reserve(latencySamples);
+        for (int i = 0; i < latencySamples; ++i)
+        {
+            const auto seq = listener.activitySequence();
+            const auto begin = std::chrono::steady_clock::now();
+            writeKey(devices[static_cast<size_t>(i) % count].writeFd, i & 1);
+            if (listener.waitForActivity(seq, std::chrono::seconds(1)))
+            {
+                latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        // CPU per event: a burst spread over every device, waited for as a whole
+        const auto seq = listener.activitySequence();
+        const double cpuBegin = cpuSeconds();
+        const auto wallBegin = std::chrono::steady_clock::now();
+        int written{ 0 };
+        for (int i = 0; i < loadEvents; ++i)
+        {
+            written += writeKey(devices[static_cast<size_t>(i) % count].writeFd, i & 1) ? 1 : 0;
+        }
+        while (listener.activitySequence() - seq < static_cast<uint64_t>(written))
+        {
+            if (!listener.waitForActivity(listener.activitySequence(), std::chrono::seconds(5)))
+            {
+                break;
+            }
+        }
+        const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallBegin).count();
+        const double cpu = cpuSeconds() - cpuBegin;
+        const auto handled = listener.activitySequence() - seq;
+
+        listener.stop();
+        for (auto &device : devices)
+        {
+            ::close(device.writeFd);
+        }
+
+        auto percentile = [&latencies](double p)
+        {
+            return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+        };
+
+        std::printf("%7zu %7d %10.1f %10.1f %12.2f %12.0f %9llu/%d\n", count, maxFd, percentile(0.5), percentile(0.99),
+                    handled ? cpu * 1e6 / handled : 0.0, wall > 0 ? handled / wall : 0.0,
+                    static_cast<unsigned long long>(handled), written);
+        return true;
+    }
+}
+
+int main()
+{
+    const size_t counts[]{ 1, 4, 16, 64, 256, 1024, 4096 };
+
+    if (!raiseFdLimit(firstFd + 2 * 4096 + 64))
+    {
+        std::fprintf(stderr, "RLIMIT_NOFILE too low for 4096 devices above fd %d\n", firstFd);
+        return 1;
+    }
+
+    for (bool edgeTriggered : { false, true })
+    {
+        std::printf("%s\n", edgeTriggered ? "edge-triggered" : "level-triggered");
+        std::printf("%7s %7s %10s %10s %12s %12s %15s\n", "devices", "max fd", "p50 us", "p99 us", "cpu us/evt", "events/s", "handled");
+        for (auto count : counts)
+        {
+            if (!run(count, edgeTriggered))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}